@@ -0,0 +1,628 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// pedsim-bench: headless benchmark driver.
+//
+// Runs every combination of the given scenarios, implementations and
+// thread counts. Each trial sets the model up from scratch, runs a
+// number of warmup ticks and then times every single tick. The tick
+// times of all trials are summarized (mean, median, p95, p99) and
+// written as JSON or CSV.
+//
+// The sequential reference of a scenario only has to be measured
+// once per machine: its mean tick time is kept in a cache file and
+// used for the speedup of later runs.
+//
+// With a libpedsim built with PED_PROFILE, the JSON also has the time
+// per tick of every phase (see ped_profile.h), and with --counters the
+// IPC and the cache and branch misses per agent and tick of each phase.
+// With ALLOC_STATS, the phases also have their allocations per tick.
+// The JSON always has the memory of the model by subsystem and the
+// resident memory of the process after the last trial.
+//
+// The JSON and CSV also have the load imbalance of the backend's
+// threads (the busiest thread's busy time over the mean, averaged over
+// the measured ticks), and the JSON their busy, barrier and idle time.
+//
+// With --verify, the first trial of every run hashes the state of the
+// crowd after every tick (see Model::enableStateHash) and compares it
+// with a sequential run of the same scenario. The first tick at which
+// the two differ is reported as first_divergent_tick.
+//
+
+#include "ped_model.h"
+#include "ped_scenario_image.h"
+#include "ped_profile.h"
+#include "ped_util.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <omp.h>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+struct Config {
+	string scenario;
+	Ped::IMPLEMENTATION implementation;
+	int threads;
+};
+
+// Thread load of the measured ticks (see Ped::TickMetrics)
+struct Load {
+	size_t ticks;
+	int threads;
+	double imbalance, maxImbalance;
+	double busy, barrier, idle;
+};
+
+struct Result {
+	Config config;
+	size_t agents;
+	size_t samples;
+	double mean, stddev, median, p95, p99, min, max;
+	// Mean tick time of the sequential version (0 if unknown)
+	double reference;
+	// The phases of all measured ticks, summed over the threads
+	// (empty without PED_PROFILE)
+	vector<Ped::PhaseTotals> phases;
+	// After the last trial, before the model is destroyed
+	Ped::MemoryFootprint memory;
+	size_t resident;
+	// With --verify: the first tick whose state differs from SEQ (0 if
+	// none did)
+	bool verified;
+	long divergentTick;
+	Load load;
+};
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const vector<double> &sorted, double p)
+{
+	size_t rank = (size_t) std::ceil(p * sorted.size());
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Runs warmup + measured ticks for each trial and returns the tick
+// times in milliseconds. Adds the phases of the measured ticks to
+// phases, if the model has a profile, and keeps the memory footprint
+// of the last trial. If hashes is given, it gets the state hashes of
+// all ticks of the first trial. Adds the thread load of the measured
+// ticks to load.
+static vector<double> measure(const Config &config, unsigned int seed, int warmup, int ticks, int trials, bool counters,
+	size_t &agents, vector<Ped::PhaseTotals> &phases, Ped::MemoryFootprint &memory, size_t &resident, vector<uint64_t> *hashes,
+	Load &load)
+{
+	vector<double> samples;
+	samples.reserve((size_t) ticks * trials);
+	omp_set_num_threads(config.threads);
+
+	for (int trial = 0; trial < trials; trial++)
+	{
+		Ped::Model model;
+		// OMP runs one thread per region
+		if (config.implementation == Ped::OMP)
+		{
+			model.setRegionFraction(1.0f / config.threads);
+		}
+		model.setup(Ped::ScenarioImage::open(config.scenario, seed), config.implementation, config.threads);
+		agents = model.getAgents().size();
+		if (counters)
+		{
+			model.enableHardwareCounters();
+		}
+		if (hashes != NULL && trial == 0)
+		{
+			model.enableStateHash(NULL, warmup + ticks);
+		}
+
+		for (int t = 0; t < warmup; t++)
+		{
+			model.tick();
+		}
+		model.resetPhaseProfile();
+		for (int t = 0; t < ticks; t++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			model.tick();
+			auto end = std::chrono::steady_clock::now();
+			samples.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+			Ped::TickMetrics metrics;
+			if (model.getTickMetrics(0, metrics))
+			{
+				load.ticks++;
+				load.threads = std::max(load.threads, metrics.threads);
+				load.imbalance += metrics.imbalance;
+				load.maxImbalance = std::max(load.maxImbalance, metrics.imbalance);
+				load.busy += metrics.busyNanoseconds / 1e6;
+				load.barrier += metrics.barrierNanoseconds / 1e6;
+				load.idle += metrics.idleNanoseconds / 1e6;
+			}
+		}
+
+		const Ped::PhaseProfile *profile = model.getPhaseProfile();
+		if (profile != NULL)
+		{
+			phases.resize(Ped::PHASE_COUNT, Ped::PhaseTotals());
+			for (int p = 0; p < Ped::PHASE_COUNT; p++)
+			{
+				Ped::PhaseTotals totals = profile->getTotals((Ped::PHASE) p);
+				phases[p].calls += totals.calls;
+				phases[p].nanoseconds += totals.nanoseconds;
+				for (int c = 0; c < Ped::COUNTER_COUNT; c++)
+				{
+					phases[p].counters[c] += totals.counters[c];
+				}
+				phases[p].allocations += totals.allocations;
+				phases[p].allocatedBytes += totals.allocatedBytes;
+			}
+		}
+		memory = model.getMemoryFootprint();
+		resident = Ped::Model::getResidentBytes();
+
+		uint64_t hash;
+		for (long tick = 1; hashes != NULL && trial == 0 && model.getStateHash(tick, hash); tick++)
+		{
+			hashes->push_back(hash);
+		}
+	}
+	return samples;
+}
+
+static Result summarize(const Config &config, size_t agents, vector<double> samples)
+{
+	Result r;
+	r.config = config;
+	r.agents = agents;
+	r.samples = samples.size();
+	r.reference = 0.0;
+	r.verified = false;
+	r.divergentTick = 0;
+	r.load = Load();
+	r.mean = r.stddev = r.median = r.p95 = r.p99 = r.min = r.max = 0.0;
+	if (samples.empty())
+	{
+		return r;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	double sum = 0.0;
+	for (double s : samples) sum += s;
+	r.mean = sum / samples.size();
+	double squares = 0.0;
+	for (double s : samples) squares += (s - r.mean) * (s - r.mean);
+	r.stddev = samples.size() > 1 ? std::sqrt(squares / (samples.size() - 1)) : 0.0;
+	r.median = percentile(samples, 0.50);
+	r.p95 = percentile(samples, 0.95);
+	r.p99 = percentile(samples, 0.99);
+	r.min = samples.front();
+	r.max = samples.back();
+	return r;
+}
+
+// The reference cache: one "key<TAB>mean" line per measured reference
+// (lines whose mean does not parse, e.g. of a truncated file, are
+// ignored).
+// The key covers everything the reference depends on, including the
+// machine, the scenario file's size and modification time, and whether
+// libpedsim times its phases or counts allocations (both slow it down).
+static string referenceKey(const string &scenario, unsigned int seed, int warmup, int ticks, int trials)
+{
+	struct stat info;
+	if (stat(scenario.c_str(), &info) != 0)
+	{
+		memset(&info, 0, sizeof(info));
+	}
+	stringstream key;
+	key << Ped::hostName() << "|" << scenario << "|" << info.st_size << "|" << info.st_mtime
+		<< "|" << seed << "|" << warmup << "|" << ticks << "|" << trials
+		<< "|" << (Ped::PhaseProfile::timesPhases() ? "profile" : "") << (Ped::PhaseProfile::countsAllocations() ? "+alloc" : "");
+	return key.str();
+}
+
+static map<string, double> readReferenceCache(const string &filename)
+{
+	map<string, double> cache;
+	for (const auto &entry : Ped::readCacheFile(filename))
+	{
+		const char *text = entry.second.c_str();
+		char *end = NULL;
+		double mean = strtod(text, &end);
+		if (end != text && *end == '\0' && std::isfinite(mean) && mean > 0.0)
+		{
+			cache[entry.first] = mean;
+		}
+	}
+	return cache;
+}
+
+static void writeReferenceCache(const string &filename, const map<string, double> &cache)
+{
+	map<string, string> lines;
+	for (const auto &entry : cache)
+	{
+		stringstream mean;
+		mean.precision(17);
+		mean << entry.second;
+		lines[entry.first] = mean.str();
+	}
+	if (!Ped::writeCacheFile(filename, lines))
+	{
+		cerr << "Note: could not write reference cache " << filename << "." << endl;
+	}
+}
+
+// Per phase: time per tick, and with counters the IPC and the misses
+// per agent and tick
+static void writePhasesJson(ostream &out, const Result &r)
+{
+	const double agentTicks = (double) r.agents * r.samples;
+	out << ", \"phases\": {";
+	bool first = true;
+	for (int p = 0; p < Ped::PHASE_COUNT; p++)
+	{
+		const Ped::PhaseTotals &phase = r.phases[p];
+		if (phase.calls == 0)
+		{
+			continue;
+		}
+		out << (first ? " " : ", ") << "\"" << Ped::phaseName((Ped::PHASE) p) << "\": { \"ms\": " << phase.nanoseconds / 1e6 / r.samples;
+		if (phase.counters[Ped::COUNTER_CYCLES] > 0)
+		{
+			out << ", \"ipc\": " << phase.ipc()
+				<< ", \"llc_misses_per_agent\": " << (agentTicks > 0 ? phase.counters[Ped::COUNTER_LLC_MISSES] / agentTicks : 0.0)
+				<< ", \"branch_misses_per_agent\": " << (agentTicks > 0 ? phase.counters[Ped::COUNTER_BRANCH_MISSES] / agentTicks : 0.0);
+		}
+		if (Ped::PhaseProfile::countsAllocations())
+		{
+			out << ", \"allocations\": " << (double) phase.allocations / r.samples
+				<< ", \"allocated_bytes\": " << (double) phase.allocatedBytes / r.samples;
+		}
+		out << " }";
+		first = false;
+	}
+	out << " }";
+}
+
+// Per tick, summed over the threads
+static void writeLoadJson(ostream &out, const Result &r)
+{
+	const Load &load = r.load;
+	const double ticks = load.ticks > 0 ? (double) load.ticks : 1.0;
+	out << ", \"load\": { \"threads\": " << load.threads << ", \"imbalance\": " << load.imbalance / ticks
+		<< ", \"max_imbalance\": " << load.maxImbalance << ", \"busy_ms\": " << load.busy / ticks
+		<< ", \"barrier_ms\": " << load.barrier / ticks << ", \"idle_ms\": " << load.idle / ticks << " }";
+}
+
+// Megabytes by subsystem
+static void writeMemoryJson(ostream &out, const Result &r)
+{
+	const Ped::MemoryFootprint &m = r.memory;
+	out << ", \"memory_mb\": { \"agents\": " << m.agents / 1e6 << ", \"routes\": " << m.routes / 1e6
+		<< ", \"spatial_index\": " << m.spatialIndex / 1e6 << ", \"heatmap\": " << m.heatmap / 1e6
+		<< ", \"fields\": " << m.fields / 1e6 << ", \"backend\": " << m.backend / 1e6
+		<< ", \"total\": " << m.total() / 1e6 << ", \"resident\": " << r.resident / 1e6 << " }";
+}
+
+static void writeJson(ostream &out, const vector<Result> &results, int warmup, int ticks, int trials)
+{
+	out << "{\n  \"host\": \"" << Ped::hostName() << "\",\n  \"warmup\": " << warmup << ",\n  \"ticks\": " << ticks
+		<< ",\n  \"trials\": " << trials << ",\n  \"results\": [";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result &r = results[i];
+		out << (i > 0 ? "," : "") << "\n    { \"scenario\": \"" << r.config.scenario << "\""
+			<< ", \"implementation\": \"" << Ped::implementationName(r.config.implementation) << "\""
+			<< ", \"threads\": " << r.config.threads
+			<< ", \"agents\": " << r.agents
+			<< ", \"samples\": " << r.samples
+			<< ", \"mean_ms\": " << r.mean
+			<< ", \"stddev_ms\": " << r.stddev
+			<< ", \"median_ms\": " << r.median
+			<< ", \"p95_ms\": " << r.p95
+			<< ", \"p99_ms\": " << r.p99
+			<< ", \"min_ms\": " << r.min
+			<< ", \"max_ms\": " << r.max
+			<< ", \"ticks_per_second\": " << (r.mean > 0.0 ? 1000.0 / r.mean : 0.0)
+			<< ", \"agents_per_second\": " << (r.mean > 0.0 ? r.agents * 1000.0 / r.mean : 0.0);
+		if (r.reference > 0.0)
+		{
+			out << ", \"reference_ms\": " << r.reference << ", \"speedup\": " << r.reference / r.mean;
+		}
+		if (r.verified)
+		{
+			out << ", \"first_divergent_tick\": ";
+			if (r.divergentTick > 0)
+			{
+				out << r.divergentTick;
+			}
+			else
+			{
+				out << "null";
+			}
+		}
+		writeLoadJson(out, r);
+		writeMemoryJson(out, r);
+		if (!r.phases.empty())
+		{
+			writePhasesJson(out, r);
+		}
+		out << " }";
+	}
+	out << "\n  ]\n}\n";
+}
+
+static void writeCsv(ostream &out, const vector<Result> &results)
+{
+	out << "scenario,implementation,threads,agents,samples,mean_ms,stddev_ms,median_ms,p95_ms,p99_ms,min_ms,max_ms,"
+		<< "ticks_per_second,agents_per_second,reference_ms,speedup,first_divergent_tick,imbalance\n";
+	for (const Result &r : results)
+	{
+		out << r.config.scenario << "," << Ped::implementationName(r.config.implementation) << "," << r.config.threads
+			<< "," << r.agents << "," << r.samples << "," << r.mean << "," << r.stddev << "," << r.median
+			<< "," << r.p95 << "," << r.p99 << "," << r.min << "," << r.max
+			<< "," << (r.mean > 0.0 ? 1000.0 / r.mean : 0.0) << "," << (r.mean > 0.0 ? r.agents * 1000.0 / r.mean : 0.0) << ",";
+		if (r.reference > 0.0)
+		{
+			out << r.reference << "," << r.reference / r.mean;
+		}
+		else
+		{
+			out << ",";
+		}
+		out << ",";
+		if (r.verified)
+		{
+			out << r.divergentTick;
+		}
+		out << "," << (r.load.ticks > 0 ? r.load.imbalance / r.load.ticks : 0.0);
+		out << "\n";
+	}
+}
+
+int main(int argc, char*argv[]) {
+	vector<string> scenarios;
+	vector<Ped::IMPLEMENTATION> implementations;
+	vector<int> threadCounts;
+	int warmup = 20;
+	int ticks = 200;
+	int trials = 5;
+	unsigned int seed = 0;
+	string format = "json";
+	string output;
+	string referenceCache = "pedsim-bench.cache";
+	bool reference = true;
+	bool refreshReference = false;
+	bool counters = false;
+	bool verify = false;
+
+	// Argument handling
+	int i = 1;
+	while (i < argc)
+	{
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--help") == 0)
+		{
+			cout << "Usage: " << argv[0] << " [--implementation SEQ,OMP,...] [--threads 1,2,...] [--warmup N] [--ticks N]"
+				<< " [--trials N] [--seed N] [--format json|csv] [-o FILE] [--reference-cache FILE] [--no-reference]"
+				<< " [--refresh-reference] [--counters] [--verify] scenario..." << endl;
+			return 0;
+		}
+		else if (strcmp(argv[i], "--implementation") == 0 && hasValue)
+		{
+			for (const string &name : Ped::splitList(argv[++i]))
+			{
+				Ped::IMPLEMENTATION implementation;
+				if (!Ped::parseImplementation(name.c_str(), implementation))
+				{
+					cerr << "Unrecognized implementation: \"" << name << "\"." << endl;
+					return 1;
+				}
+				implementations.push_back(implementation);
+			}
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+		{
+			for (const string &count : Ped::splitList(argv[++i]))
+			{
+				threadCounts.push_back(std::max(1, std::stoi(count)));
+			}
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && hasValue)
+		{
+			warmup = std::max(0, std::stoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--ticks") == 0 && hasValue)
+		{
+			ticks = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--trials") == 0 && hasValue)
+		{
+			trials = std::max(1, std::stoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+		{
+			seed = (unsigned int) std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--format") == 0 && hasValue)
+		{
+			format = argv[++i];
+		}
+		else if (strcmp(argv[i], "-o") == 0 && hasValue)
+		{
+			output = argv[++i];
+		}
+		else if (strcmp(argv[i], "--reference-cache") == 0 && hasValue)
+		{
+			referenceCache = argv[++i];
+		}
+		else if (strcmp(argv[i], "--no-reference") == 0)
+		{
+			reference = false;
+		}
+		else if (strcmp(argv[i], "--refresh-reference") == 0)
+		{
+			refreshReference = true;
+		}
+		else if (strcmp(argv[i], "--counters") == 0)
+		{
+			counters = true;
+		}
+		else if (strcmp(argv[i], "--verify") == 0)
+		{
+			verify = true;
+		}
+		else if (argv[i][0] == '-')
+		{
+			cerr << "Unrecognized argument: \"" << argv[i] << "\"." << endl;
+			return 1;
+		}
+		else
+		{
+			scenarios.push_back(argv[i]);
+		}
+		i += 1;
+	}
+
+	if (format != "json" && format != "csv")
+	{
+		cerr << "Unknown format: \"" << format << "\"." << endl;
+		return 1;
+	}
+	if (scenarios.empty())
+	{
+		scenarios.push_back("scenario.xml");
+	}
+	if (implementations.empty())
+	{
+		implementations.push_back(Ped::SEQ);
+	}
+	if (threadCounts.empty())
+	{
+		threadCounts.push_back(omp_get_max_threads());
+	}
+
+	map<string, double> cache;
+	if (reference)
+	{
+		cache = readReferenceCache(referenceCache);
+	}
+	bool cacheChanged = false;
+
+	vector<Result> results;
+	for (const string &scenario : scenarios)
+	{
+		// The sequential reference, unless it is cached
+		double referenceMean = 0.0;
+		if (reference)
+		{
+			const string key = referenceKey(scenario, seed, warmup, ticks, trials);
+			auto cached = cache.find(key);
+			if (cached != cache.end() && !refreshReference)
+			{
+				referenceMean = cached->second;
+			}
+			else
+			{
+				cerr << "Measuring the reference (SEQ) of " << scenario << " ..." << endl;
+				size_t agents = 0;
+				vector<Ped::PhaseTotals> phases;
+				Ped::MemoryFootprint memory;
+				size_t resident;
+				Load load = {};
+				Config config = { scenario, Ped::SEQ, 1 };
+				referenceMean = summarize(config, agents, measure(config, seed, warmup, ticks, trials, false, agents, phases, memory, resident, NULL, load)).mean;
+				cache[key] = referenceMean;
+				cacheChanged = true;
+			}
+		}
+
+		// The states the backends are compared with
+		vector<uint64_t> referenceHashes;
+		if (verify)
+		{
+			cerr << "Hashing the states of SEQ on " << scenario << " ..." << endl;
+			size_t agents = 0;
+			vector<Ped::PhaseTotals> phases;
+			Ped::MemoryFootprint memory;
+			size_t resident;
+			Load load = {};
+			Config config = { scenario, Ped::SEQ, 1 };
+			measure(config, seed, warmup, ticks, 1, false, agents, phases, memory, resident, &referenceHashes, load);
+		}
+
+		for (Ped::IMPLEMENTATION implementation : implementations)
+		{
+			for (int threads : threadCounts)
+			{
+				Config config = { scenario, implementation, threads };
+				cerr << "Running " << scenario << " with " << Ped::implementationName(implementation)
+					<< " on " << threads << " threads ..." << endl;
+				size_t agents = 0;
+				vector<Ped::PhaseTotals> phases;
+				Ped::MemoryFootprint memory = {};
+				size_t resident = 0;
+				vector<uint64_t> hashes;
+				Load load = {};
+				vector<double> samples = measure(config, seed, warmup, ticks, trials, counters, agents, phases, memory, resident,
+					verify ? &hashes : NULL, load);
+				Result result = summarize(config, agents, samples);
+				result.reference = referenceMean;
+				result.phases = phases;
+				result.memory = memory;
+				result.resident = resident;
+				result.verified = verify;
+				result.divergentTick = 0;
+				result.load = load;
+				for (size_t t = 0; verify && t < hashes.size() && t < referenceHashes.size(); t++)
+				{
+					if (hashes[t] != referenceHashes[t])
+					{
+						result.divergentTick = (long) t + 1;
+						cerr << Ped::implementationName(implementation) << " on " << threads
+							<< " threads diverges from SEQ at tick " << result.divergentTick << "." << endl;
+						break;
+					}
+				}
+				results.push_back(result);
+			}
+		}
+	}
+
+	if (cacheChanged)
+	{
+		writeReferenceCache(referenceCache, cache);
+	}
+
+	ofstream file;
+	if (!output.empty())
+	{
+		file.open(output);
+		if (!file)
+		{
+			cerr << "Could not write " << output << "." << endl;
+			return 1;
+		}
+	}
+	ostream &out = output.empty() ? cout : file;
+	if (format == "json")
+	{
+		writeJson(out, results, warmup, ticks, trials);
+	}
+	else
+	{
+		writeCsv(out, results);
+	}
+	return 0;
+}
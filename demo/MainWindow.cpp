@@ -8,7 +8,11 @@
 
 #include <stdlib.h>
 
-MainWindow::MainWindow(const Ped::Model &pedModel) : model(pedModel)
+MainWindow::MainWindow(const Ped::Model &pedModel) : MainWindow(pedModel, pedModel.getAgents(), pedModel.getHeatmapSize())
+{
+}
+
+MainWindow::MainWindow(const Ped::Model &pedModel, const std::vector<Ped::Tagent*> &agents, int heatmapSize) : model(pedModel)
 {
 	// The Window 
 	graphicsView = new QGraphicsView();
@@ -36,8 +40,6 @@ MainWindow::MainWindow(const Ped::Model &pedModel) : model(pedModel)
 	}
 
 	// Create viewAgents with references to the position of the model counterparts
-	const std::vector<Ped::Tagent*> &agents = model.getAgents();
-
 	std::vector<Ped::Tagent*>::const_iterator it;
 
 	for (it = agents.begin(); it != agents.end(); it++)
@@ -45,7 +47,6 @@ MainWindow::MainWindow(const Ped::Model &pedModel) : model(pedModel)
 		viewAgents.push_back(new ViewAgent(*it, scene));
 	}
 
-	const int heatmapSize = model.getHeatmapSize();
 	QPixmap pixmapDummy = QPixmap(heatmapSize, heatmapSize);
 	pixmap = scene->addPixmap(pixmapDummy);
 
@@ -16,6 +16,10 @@ public:
 	MainWindow() = delete;
 	MainWindow(const Ped::Model &model);
 
+	// Shows the given agents instead of the model's (trajectory replay),
+	// in a view sized for a heatmap of heatmapSize pixels
+	MainWindow(const Ped::Model &model, const std::vector<Ped::Tagent*> &agents, int heatmapSize);
+
 	// paint is called after each computational step
 	// to repaint the window
 	void paint();
@@ -14,9 +14,96 @@
 
 using namespace std;
 
-PedSimulation::PedSimulation(Ped::Model &model_, MainWindow *window_, bool timing_mode) : model(model_), window(window_), maxSimulationSteps(-1), timingMode(timing_mode)
+// Recorded ticks per second at replay speed 1
+#define REPLAY_TICKS_PER_SECOND 20.0
+
+PedSimulation::PedSimulation(Ped::Model &model_, MainWindow *window_, bool timing_mode) : model(model_), window(window_), maxSimulationSteps(-1), timingMode(timing_mode), trajectory(NULL)
+{
+	tickCounter = 0;
+}
+
+PedSimulation::PedSimulation(Ped::Model &model_, const Ped::TrajectoryReader &trajectory_, double speed) : model(model_), window(NULL), maxSimulationSteps(-1), timingMode(false), trajectory(&trajectory_), replaySpeed(speed), replayBlock(0), replayStartTick(0)
 {
 	tickCounter = 0;
+
+	// The view agents point into the position buffers, which every
+	// replayed block is copied into
+	const size_t count = trajectory->getAgentCount();
+	replayX.resize(count);
+	replayY.resize(count);
+	if (trajectory->getBlockCount() > 0)
+	{
+		trajectory->read(0, replayX.data(), replayY.data());
+		replayStartTick = trajectory->getTick(0);
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		replayAgents.push_back(new Ped::Tagent(&replayX[i], &replayY[i]));
+	}
+}
+
+PedSimulation::~PedSimulation()
+{
+	for (auto agent : replayAgents)
+	{
+		delete agent;
+	}
+}
+
+void PedSimulation::seek(long tick)
+{
+	if (trajectory == NULL || trajectory->getBlockCount() == 0)
+	{
+		return;
+	}
+	showBlock(trajectory->findBlock(tick));
+	replayStartTick = trajectory->getTick(replayBlock);
+	replayClock.restart();
+}
+
+void PedSimulation::showBlock(size_t block)
+{
+	replayBlock = block;
+	trajectory->read(block, replayX.data(), replayY.data());
+	tickCounter++;
+	if (window != NULL)
+		window->paint();
+}
+
+void PedSimulation::replayOneStep()
+{
+	const size_t last = trajectory->getBlockCount();
+	if (last == 0)
+	{
+		QApplication::quit();
+		return;
+	}
+
+	size_t next;
+	if (replaySpeed <= 0.0)
+	{
+		next = replayBlock + 1;
+	}
+	else
+	{
+		// The tick that is due now; when rendering can not keep up,
+		// the blocks in between are skipped (and never read)
+		long due = replayStartTick + (long) (replayClock.elapsed() / 1000.0 * REPLAY_TICKS_PER_SECOND * replaySpeed);
+		next = trajectory->findBlock(due);
+		if (next == replayBlock)
+		{
+			if (replayBlock + 1 == last)
+				QApplication::quit();
+			return;
+		}
+	}
+
+	if (next >= last)
+	{
+		QApplication::quit();
+		return;
+	}
+	showBlock(next);
 }
 
 int PedSimulation::getTickCount() const
@@ -25,6 +112,12 @@ int PedSimulation::getTickCount() const
 }
 void PedSimulation::simulateOneStep()
 {
+	if (trajectory != NULL)
+	{
+		replayOneStep();
+		return;
+	}
+
 	tickCounter++;
 	model.tick();
     if (!timingMode)
@@ -50,6 +143,15 @@ void PedSimulation::runSimulationWithQt(int maxNumberOfStepsToSimulate)
 {
 	maxSimulationSteps = maxNumberOfStepsToSimulate;
 
+	if (trajectory != NULL)
+	{
+		// Replay until the end of the recording; frames are only
+		// painted when a new block is due
+		replayClock.start();
+		if (replaySpeed > 0.0)
+			movetimer.setInterval(10);
+	}
+
 	//movetimer.setInterval(50); // Limits the simulation to 20 FPS (if one so whiches).
 	QObject::connect(&movetimer, SIGNAL(timeout()), this, SLOT(simulateOneStep()));
 	movetimer.start();
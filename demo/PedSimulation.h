@@ -11,7 +11,10 @@
 
 #include <QObject>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <vector>
 #include "ped_model.h"
+#include "ped_trajectory.h"
 #include "MainWindow.h"
 // Driver for updating the world
 class PedSimulation : public QObject{
@@ -19,8 +22,22 @@ class PedSimulation : public QObject{
 
 public:
 	PedSimulation(Ped::Model &model, MainWindow *window, bool timingMode);
+
+	// Replay mode: plays a recorded trajectory back instead of ticking
+	// the model. speed is relative to 20 recorded ticks per second,
+	// 0 shows every recorded tick as fast as possible.
+	PedSimulation(Ped::Model &model, const Ped::TrajectoryReader &trajectory, double speed);
 	PedSimulation() = delete;
-    ~PedSimulation() {}
+    ~PedSimulation();
+
+	// Replay mode: the agents whose positions follow the recording, and
+	// the window showing them (created after the simulation)
+	const std::vector<Ped::Tagent*> & getReplayAgents() const { return replayAgents; }
+	void setWindow(MainWindow *window_) { window = window_; }
+
+	// Replay mode: continues the playback from the last recorded tick
+	// at or before tick
+	void seek(long tick);
 
     void runSimulation(int maxNumberOfStepsToSimulate);
 	int getTickCount() const;
@@ -41,5 +58,19 @@ private:
 
 	// Running simulation with GUI. Use for visualization.
 	void runSimulationWithQt(int maxNumberOfStepsToSimulate);
+
+	// Replay mode (NULL otherwise)
+	const Ped::TrajectoryReader *trajectory;
+	double replaySpeed;
+	size_t replayBlock;
+	long replayStartTick;
+	QElapsedTimer replayClock;
+	std::vector<int> replayX;
+	std::vector<int> replayY;
+	std::vector<Ped::Tagent*> replayAgents;
+
+	// Shows the next block that is due
+	void replayOneStep();
+	void showBlock(size_t block);
 };
 #endif
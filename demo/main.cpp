@@ -11,7 +11,8 @@
 #undef max
 #include "ped_model.h"
 #include "MainWindow.h"
-#include "ParseScenario.h"
+#include "ped_scenario_image.h"
+#include "ped_trajectory.h"
 
 #include <QGraphicsView>
 #include <QGraphicsScene>
@@ -24,6 +25,10 @@
 #include <chrono>
 #include <ctime>
 #include <cstring>
+#include <string>
+#include <algorithm>
+
+using namespace std;
 
 #pragma comment(lib, "libpedsim.lib")
 
@@ -41,6 +46,40 @@ int main(int argc, char*argv[]) {
 	// Number of threads to use in PTHREADS implementation
 	int number_of_threads = 2;
 
+	// Seed for the random placement of agents in the scenario
+	unsigned int seed = 0;
+
+	// Optional heatmap frame export (every Nth tick)
+	std::string heatmap_export_file;
+	int heatmap_export_every = 1;
+
+	// Optional periodic checkpoints, and a checkpoint to resume from
+	std::string checkpoint_file;
+	int checkpoint_every = 100;
+	std::string restore_file;
+
+	// Optional trajectory recording
+	std::string record_file;
+	int record_every = 1;
+	int record_stride = 1;
+
+	// Optional live position stream (named pipe or unix:<socket>)
+	std::string stream_target;
+
+	// Optional POSIX shared memory segment with the state of every tick
+	std::string shared_state_name;
+
+	// Optional timeline of the tick phases (libpedsim built with PED_PROFILE)
+	std::string trace_file;
+
+	// Optional log of the state hash of every tick
+	std::string state_hash_file;
+
+	// Optional replay of a recorded trajectory instead of simulating
+	std::string replay_file;
+	double replay_speed = 1.0;
+	long seek_tick = 0;
+
 	// Argument handling
 	while (i < argc)
 	{
@@ -53,7 +92,7 @@ int main(int argc, char*argv[]) {
 			}
 			else if (strcmp(&argv[i][2], "help") == 0)
 			{
-				cout << "Usage: " << argv[0] << " [--help] [--timing-mode] [--implementation IMPL] [--threads N] [scenario]" << endl;
+				cout << "Usage: " << argv[0] << " [--help] [--timing-mode] [--implementation IMPL] [--threads N] [--seed N] [--export-heatmap FILE] [--export-every N] [--checkpoint FILE] [--checkpoint-every N] [--restore FILE] [--record FILE] [--record-every N] [--record-stride K] [--stream PIPE|unix:SOCKET] [--shared-state /NAME] [--replay FILE] [--replay-speed X] [--seek TICK] [--trace FILE] [--state-hash FILE] [scenario]" << endl;
 				return 0;
 			}
 			else if (strcmp(&argv[i][2], "implementation") == 0)
@@ -75,6 +114,10 @@ int main(int argc, char*argv[]) {
                                 {
                                         implementation_to_test = Ped::CUDA;
                                 }
+				else if (strcmp(&argv[i][0], "AUTO") == 0)
+				{
+					implementation_to_test = Ped::AUTO;
+				}
 				else if (strcmp(&argv[i][0], "SEQ") != 0)
 				{
 					cerr << "Unrecognized implementation: \"" << argv[i] << "\". Try one of SEQ | PTHREADS  " << endl;
@@ -85,6 +128,86 @@ int main(int argc, char*argv[]) {
 				i += 1;
 				number_of_threads = std::stoi(&argv[i][0]);
 			}
+			else if (strcmp(&argv[i][2], "seed") == 0)
+			{
+				i += 1;
+				seed = (unsigned int) std::stoul(&argv[i][0]);
+			}
+			else if (strcmp(&argv[i][2], "export-heatmap") == 0)
+			{
+				i += 1;
+				heatmap_export_file = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "export-every") == 0)
+			{
+				i += 1;
+				heatmap_export_every = std::stoi(&argv[i][0]);
+			}
+			else if (strcmp(&argv[i][2], "checkpoint") == 0)
+			{
+				i += 1;
+				checkpoint_file = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "checkpoint-every") == 0)
+			{
+				i += 1;
+				checkpoint_every = std::stoi(&argv[i][0]);
+			}
+			else if (strcmp(&argv[i][2], "restore") == 0)
+			{
+				i += 1;
+				restore_file = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "record") == 0)
+			{
+				i += 1;
+				record_file = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "record-every") == 0)
+			{
+				i += 1;
+				record_every = std::stoi(&argv[i][0]);
+			}
+			else if (strcmp(&argv[i][2], "record-stride") == 0)
+			{
+				i += 1;
+				record_stride = std::stoi(&argv[i][0]);
+			}
+			else if (strcmp(&argv[i][2], "stream") == 0)
+			{
+				i += 1;
+				stream_target = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "shared-state") == 0)
+			{
+				i += 1;
+				shared_state_name = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "trace") == 0)
+			{
+				i += 1;
+				trace_file = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "state-hash") == 0)
+			{
+				i += 1;
+				state_hash_file = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "replay") == 0)
+			{
+				i += 1;
+				replay_file = argv[i];
+			}
+			else if (strcmp(&argv[i][2], "replay-speed") == 0)
+			{
+				i += 1;
+				replay_speed = std::stod(&argv[i][0]);
+			}
+			else if (strcmp(&argv[i][2], "seek") == 0)
+			{
+				i += 1;
+				seek_tick = std::stol(&argv[i][0]);
+			}
 			else
 			{
 				cerr << "Unrecognized command: \"" << argv[i] << "\". Ignoring ..." << endl;
@@ -100,10 +223,48 @@ int main(int argc, char*argv[]) {
 	int retval = 0;
 	{ // This scope is for the purpose of removing false memory leak positives
 
-		// Reading the scenario file and setting up the crowd simulation model
+		// The timing mode sets up its own models, and a replay never
+		// ticks the model: only the graphics version reads the scenario
 		Ped::Model model;
-		ParseScenario parser(scenefile);
-		model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+		const bool replay_mode = !timing_mode && !replay_file.empty();
+		const bool gui_simulation = !timing_mode && !replay_mode;
+		if (gui_simulation)
+		{
+			// Reading the scenario file (through its binary cache) and setting up the crowd simulation model
+			model.setup(Ped::ScenarioImage::open(scenefile.toStdString(), seed), implementation_to_test);
+			if (!heatmap_export_file.empty())
+			{
+				model.enableHeatmapExport(heatmap_export_file.c_str(), heatmap_export_every);
+			}
+			if (!restore_file.empty())
+			{
+				model.restoreCheckpoint(restore_file.c_str());
+			}
+			if (!checkpoint_file.empty())
+			{
+				model.enableCheckpoints(checkpoint_file.c_str(), checkpoint_every);
+			}
+			if (!record_file.empty())
+			{
+				model.enableTrajectoryRecording(record_file.c_str(), record_every, record_stride);
+			}
+			if (!stream_target.empty())
+			{
+				model.enablePositionStream(stream_target.c_str());
+			}
+			if (!shared_state_name.empty())
+			{
+				model.enableSharedState(shared_state_name.c_str());
+			}
+			if (!trace_file.empty())
+			{
+				model.enableTrace(trace_file.c_str());
+			}
+			if (!state_hash_file.empty())
+			{
+				model.enableStateHash(state_hash_file.c_str());
+			}
+		}
 
 		// Default number of steps to simulate. Feel free to change this.
 		const int maxNumberOfStepsToSimulate = 1000;
@@ -121,8 +282,7 @@ int main(int argc, char*argv[]) {
 			double fps_seq, fps_target;
 			{
 				Ped::Model model;
-				ParseScenario parser(scenefile);
-				model.setup(parser.getAgents(), parser.getWaypoints(), Ped::SEQ);
+				model.setup(Ped::ScenarioImage::open(scenefile.toStdString(), seed), Ped::SEQ);
 				PedSimulation simulation(model, NULL, timing_mode);
 				// Simulation mode to use when profiling (without any GUI)
 				std::cout << "Running reference version...\n";
@@ -135,8 +295,31 @@ int main(int argc, char*argv[]) {
 
 			{
 				Ped::Model model;
-				ParseScenario parser(scenefile);
-				model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test, number_of_threads);
+				model.setup(Ped::ScenarioImage::open(scenefile.toStdString(), seed), implementation_to_test, number_of_threads);
+				if (!heatmap_export_file.empty())
+				{
+					model.enableHeatmapExport(heatmap_export_file.c_str(), heatmap_export_every);
+				}
+				if (!restore_file.empty())
+				{
+					model.restoreCheckpoint(restore_file.c_str());
+				}
+				if (!checkpoint_file.empty())
+				{
+					model.enableCheckpoints(checkpoint_file.c_str(), checkpoint_every);
+				}
+				if (!record_file.empty())
+				{
+					model.enableTrajectoryRecording(record_file.c_str(), record_every, record_stride);
+				}
+				if (!trace_file.empty())
+				{
+					model.enableTrace(trace_file.c_str());
+				}
+				if (!state_hash_file.empty())
+				{
+					model.enableStateHash(state_hash_file.c_str());
+				}
 				PedSimulation simulation(model, NULL, timing_mode);
 				// Simulation mode to use when profiling (without any GUI)
 				std::cout << "Running target version...\n";
@@ -150,6 +333,35 @@ int main(int argc, char*argv[]) {
 			
 			
 
+		}
+		// Replay of a recorded trajectory, without ticking the model
+		else if (replay_mode)
+		{
+			Ped::TrajectoryReader trajectory(replay_file.c_str());
+			if (!trajectory.isOpen() || trajectory.getBlockCount() == 0)
+			{
+				cerr << "Nothing to replay in " << replay_file << "." << endl;
+				return 1;
+			}
+
+			QApplication app(argc, argv);
+			PedSimulation simulation(model, trajectory, replay_speed);
+			simulation.seek(seek_tick);
+			// Sized like the heatmap of the recorded world would be
+			const int worldSize = std::max(trajectory.getExtentX(), trajectory.getExtentY());
+			MainWindow mainwindow(model, simulation.getReplayAgents(), worldSize * MainWindow::cellsizePixel);
+			simulation.setWindow(&mainwindow);
+
+			cout << "Replaying " << trajectory.getBlockCount() << " recorded ticks of " << trajectory.getAgentCount() << " agents ..." << endl;
+
+			auto start = std::chrono::steady_clock::now();
+			mainwindow.show();
+			simulation.runSimulation(maxNumberOfStepsToSimulate);
+			retval = app.exec();
+
+			auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now() - start);
+			float fps = ((float)simulation.getTickCount()) / ((float)duration.count())*1000.0;
+			cout << "Time: " << duration.count() << " milliseconds, " << fps << " Frames Per Second." << std::endl;
 		}
 		// Graphics version
 		else
@@ -0,0 +1,279 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// pedsim-gen: procedural scenario generator for scaling studies.
+//
+// Writes a scenario image (see ped_scenario_image.h) with the
+// requested number of agents, laid out as one of a few classic
+// crowd situations. Agents never share a position. The output
+// only depends on the arguments, so the same seed gives the same
+// file on every machine and for any number of threads.
+//
+
+#include "ped_scenario_image.h"
+#include "ped_util.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <omp.h>
+
+#include <stdlib.h>
+
+using namespace std;
+
+// Agents of a group are placed band by band, this many rows at a time
+#define BAND_ROWS 64
+
+// A rectangle [x0, x0 + w) x [y0, y0 + h) filled with n agents that
+// all follow the same route
+struct Group {
+	int64_t x0, y0, w, h;
+	uint64_t n;
+	std::vector<uint32_t> route;
+};
+
+struct Waypoint {
+	double x, y, r;
+};
+
+// Uniform in [0, 1)
+static double nextUnit(uint64_t &state)
+{
+	return (Ped::splitmix64(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int64_t ceilDiv(double a, double b)
+{
+	return (int64_t) std::ceil(a / b);
+}
+
+// Builds the groups and waypoints of a layout. area is the number of
+// cells the agents should be spread over (agents / density).
+static bool makeLayout(const string &layout, uint64_t agents, double area, vector<Group> &groups, vector<Waypoint> &waypoints)
+{
+	if (layout == "uniform")
+	{
+		// One square, four quadrants walking to the opposite corner and back
+		int64_t side = std::max<int64_t>(2, ceilDiv(std::sqrt(area), 1.0));
+		int64_t half = side / 2;
+		double r = std::max(1.0, side / 10.0);
+		waypoints = { { 0.0, 0.0, r }, { (double) side, 0.0, r }, { 0.0, (double) side, r }, { (double) side, (double) side, r } };
+		uint64_t quarter = agents / 4;
+		groups.push_back({ 0, 0, half, half, quarter, { 3, 0 } });
+		groups.push_back({ half, 0, side - half, half, quarter, { 2, 1 } });
+		groups.push_back({ 0, half, half, side - half, quarter, { 1, 2 } });
+		groups.push_back({ half, half, side - half, side - half, agents - 3 * quarter, { 0, 3 } });
+	}
+	else if (layout == "corridor")
+	{
+		// Counter-flow: two crowds at the ends of a long corridor walking
+		// through each other. The corridor is about 8 times longer than wide.
+		int64_t width = std::max<int64_t>(1, ceilDiv(std::sqrt(area / 5.0), 1.0));
+		int64_t length = std::max<int64_t>(1, ceilDiv(area / 2.0, width));
+		int64_t total = 3 * length;
+		waypoints = { { 0.0, width / 2.0, width / 2.0 }, { (double) total, width / 2.0, width / 2.0 } };
+		groups.push_back({ 0, 0, length, width, agents / 2, { 1, 0 } });
+		groups.push_back({ 2 * length, 0, length, width, agents - agents / 2, { 0, 1 } });
+	}
+	else if (layout == "crossing")
+	{
+		// Four-way crossing: one crowd in each arm of a plus, each walking
+		// to the opposite arm and back
+		int64_t width = std::max<int64_t>(1, ceilDiv(std::sqrt(area / 8.0), 1.0));
+		int64_t arm = std::max<int64_t>(1, ceilDiv(area / 4.0, width));
+		int64_t total = 2 * arm + width;
+		double mid = arm + width / 2.0;
+		double r = width / 2.0;
+		waypoints = { { 0.0, mid, r }, { (double) total, mid, r }, { mid, 0.0, r }, { mid, (double) total, r } };
+		uint64_t quarter = agents / 4;
+		groups.push_back({ 0, arm, arm, width, quarter, { 1, 0 } });
+		groups.push_back({ arm + width, arm, arm, width, quarter, { 0, 1 } });
+		groups.push_back({ arm, 0, width, arm, quarter, { 3, 2 } });
+		groups.push_back({ arm, arm + width, width, arm, agents - 3 * quarter, { 2, 3 } });
+	}
+	else if (layout == "bottleneck")
+	{
+		// A full room that has to pass through one narrow gate to the exit
+		int64_t height = std::max<int64_t>(1, ceilDiv(std::sqrt(area), 1.0));
+		int64_t width = std::max<int64_t>(1, ceilDiv(area, height));
+		double gateX = width + height / 4.0;
+		waypoints = { { gateX, height / 2.0, std::max(1.0, height / 50.0) }, { gateX + height / 2.0, height / 2.0, height / 4.0 } };
+		groups.push_back({ 0, 0, width, height, agents, { 0, 1 } });
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char*argv[]) {
+	string layout = "uniform";
+	string output = "generated.pedc";
+	uint64_t agents = 10000;
+	double density = 0.5;
+	unsigned int seed = 0;
+
+	// Argument handling
+	int i = 1;
+	while (i < argc)
+	{
+		if (strcmp(argv[i], "--help") == 0 || i + 1 >= argc)
+		{
+			cout << "Usage: " << argv[0] << " [--layout uniform|corridor|crossing|bottleneck] [--agents N]"
+				<< " [--density D] [--seed N] [-o FILE]" << endl;
+			return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+		}
+		else if (strcmp(argv[i], "--layout") == 0)
+		{
+			layout = argv[++i];
+		}
+		else if (strcmp(argv[i], "--agents") == 0)
+		{
+			agents = (uint64_t) std::stod(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--density") == 0)
+		{
+			density = std::stod(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--seed") == 0)
+		{
+			seed = (unsigned int) std::stoul(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-o") == 0)
+		{
+			output = argv[++i];
+		}
+		else
+		{
+			cerr << "Unrecognized argument: \"" << argv[i] << "\"." << endl;
+			return 1;
+		}
+		i += 1;
+	}
+
+	if (density <= 0.0 || density > 1.0)
+	{
+		cerr << "Density must be in (0, 1]: it is the fraction of occupied cells." << endl;
+		return 1;
+	}
+
+	vector<Group> groups;
+	vector<Waypoint> waypoints;
+	if (!makeLayout(layout, agents, agents / density, groups, waypoints))
+	{
+		cerr << "Unknown layout: \"" << layout << "\"." << endl;
+		return 1;
+	}
+
+	// Where each group starts in the agent and route columns
+	vector<uint64_t> agentStart(groups.size() + 1, 0);
+	vector<uint64_t> routeStart(groups.size() + 1, 0);
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		if ((uint64_t) groups[g].w * groups[g].h < groups[g].n)
+		{
+			cerr << "Layout too small for the requested agents." << endl;
+			return 1;
+		}
+		agentStart[g + 1] = agentStart[g] + groups[g].n;
+		routeStart[g + 1] = routeStart[g] + groups[g].n * groups[g].route.size();
+	}
+	if (routeStart.back() > UINT32_MAX)
+	{
+		cerr << "Too many agents for the image format." << endl;
+		return 1;
+	}
+
+	Ped::ScenarioImage *image = Ped::ScenarioImage::create(output, agents, routeStart.back(), waypoints.size(), 0, seed);
+	if (image == NULL)
+	{
+		cerr << "Could not create " << output << "." << endl;
+		return 1;
+	}
+
+	for (size_t w = 0; w < waypoints.size(); w++)
+	{
+		image->getWaypointX()[w] = waypoints[w].x;
+		image->getWaypointY()[w] = waypoints[w].y;
+		image->getWaypointR()[w] = waypoints[w].r;
+	}
+
+	// Every band of every group is independent: it gets its exact share of
+	// the group's agents and picks that many distinct cells with selection
+	// sampling, using its own generator seeded from (seed, group, band)
+	vector<pair<size_t, int64_t> > bands;
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		for (int64_t row = 0; row < groups[g].h; row += BAND_ROWS)
+		{
+			bands.push_back(make_pair(g, row));
+		}
+	}
+
+	int *xs = image->getAgentX();
+	int *ys = image->getAgentY();
+	uint32_t *routeIndex = image->getRouteStart();
+	uint32_t *route = image->getRoute();
+
+	#pragma omp parallel for schedule(dynamic)
+	for (size_t b = 0; b < bands.size(); b++)
+	{
+		const Group &group = groups[bands[b].first];
+		const int64_t row = bands[b].second;
+		const int64_t rows = std::min<int64_t>(BAND_ROWS, group.h - row);
+		const uint64_t cells = (uint64_t) group.w * group.h;
+
+		// Agents in this band: difference of the proportional prefix counts
+		const uint64_t first = (uint64_t) ((long double) group.n * (row * group.w) / cells);
+		const uint64_t last = (uint64_t) ((long double) group.n * ((row + rows) * group.w) / cells);
+		uint64_t needed = last - first;
+
+		uint64_t state = ((uint64_t) seed << 32) ^ ((uint64_t) bands[b].first << 24) ^ (uint64_t) row;
+		Ped::splitmix64(state);
+
+		uint64_t out = agentStart[bands[b].first] + first;
+		uint64_t remaining = (uint64_t) rows * group.w;
+		for (int64_t y = row; y < row + rows && needed > 0; y++)
+		{
+			for (int64_t x = 0; x < group.w && needed > 0; x++, remaining--)
+			{
+				// Take this cell with probability needed / remaining
+				if (nextUnit(state) * remaining < needed)
+				{
+					xs[out] = (int) (group.x0 + x);
+					ys[out] = (int) (group.y0 + y);
+					out++;
+					needed--;
+				}
+			}
+		}
+	}
+
+	// Routes: the same for every agent of a group
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		const size_t length = groups[g].route.size();
+		#pragma omp parallel for schedule(static)
+		for (uint64_t a = 0; a < groups[g].n; a++)
+		{
+			uint64_t r = routeStart[g] + a * length;
+			routeIndex[agentStart[g] + a] = (uint32_t) r;
+			for (size_t k = 0; k < length; k++)
+			{
+				route[r + k] = groups[g].route[k];
+			}
+		}
+	}
+	routeIndex[agents] = (uint32_t) routeStart.back();
+
+	delete image;
+
+	cout << "Wrote " << agents << " agents (" << layout << ", density " << density
+		<< ", seed " << seed << ") to " << output << "." << endl;
+	return 0;
+}
@@ -1,3 +1,5 @@
+// Only built when nvcc is available (see Makefile)
+#ifdef PED_WITH_CUDA
 #include "cuda_runtime.h"
 #include "device_launch_parameters.h"
 #include "cuda_tick.h"
@@ -99,3 +101,5 @@ Error:
 
 	return cudaStatus;
 }
+
+#endif
@@ -3,90 +3,171 @@
 // Implements the heatmap functionality. 
 //
 #include "ped_model.h"
+#include "ped_heatmap_export.h"
+#include "ped_shared_state.h"
+#include "ped_profile.h"
 
 #include <cstdlib>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 using namespace std;
 
 // Memory leak check with msvc++
 #include <stdlib.h>
 
+// Turns the heatmap on. The buffers are only allocated here, so runs that
+// never ask for a heatmap (e.g. timing mode) do not pay for it.
+bool Ped::Model::enableHeatmap(int size, int cellSize, float decay)
+{
+	// Default: just large enough to cover the scenario
+	size = size > 0 ? size : std::max(extentX, extentY);
+
+	// The exporter writes frames of the size it was created with
+	if (heatmap != NULL && heatmapExporter != NULL && size != heatmapSize)
+	{
+		cout << "Warning: the heatmap cannot change its size while it is exported." << endl;
+		return false;
+	}
+
+	freeHeatmapSeq();
+
+	heatmapSize = size;
+	heatmapCellSize = cellSize > 0 ? cellSize : 1;
+	heatmapDecay = decay;
+
+	setupHeatmapSeq();
+
+	// A shared state segment is laid out for the heatmap it publishes
+	if (sharedState != NULL && sharedState->getHeatmapSize() != heatmapSize)
+	{
+		sharedState->resize(heatmapSize);
+	}
+	return true;
+}
+
+// Starts exporting every Nth heatmap frame to filename
+void Ped::Model::enableHeatmapExport(const char *filename, int everyNthTick)
+{
+	if (heatmap == NULL)
+	{
+		enableHeatmap();
+	}
+
+	delete heatmapExporter;
+	heatmapExporter = new Ped::HeatmapExporter(filename, heatmapSize, heatmapSize);
+	heatmapExportEvery = everyNthTick > 0 ? everyNthTick : 1;
+}
+
 // Sets up the heatmap
 void Ped::Model::setupHeatmapSeq()
 {
-	int *hm = (int*)calloc(SIZE*SIZE, sizeof(int));
-	int *shm = (int*)malloc(SCALED_SIZE*SCALED_SIZE*sizeof(int));
-	int *bhm = (int*)malloc(SCALED_SIZE*SCALED_SIZE*sizeof(int));
+	const int scaledSize = heatmapSize*heatmapCellSize;
 
-	heatmap = (int**)malloc(SIZE*sizeof(int*));
+	int *hm = (int*)calloc(heatmapSize*heatmapSize, sizeof(int));
+	int *shm = (int*)malloc(scaledSize*scaledSize*sizeof(int));
+	int *bhm = (int*)calloc(scaledSize*scaledSize, sizeof(int));
 
-	scaled_heatmap = (int**)malloc(SCALED_SIZE*sizeof(int*));
-	blurred_heatmap = (int**)malloc(SCALED_SIZE*sizeof(int*));
+	heatmap = (int**)malloc(heatmapSize*sizeof(int*));
 
-	for (int i = 0; i < SIZE; i++)
+	scaled_heatmap = (int**)malloc(scaledSize*sizeof(int*));
+	blurred_heatmap = (int**)malloc(scaledSize*sizeof(int*));
+
+	for (int i = 0; i < heatmapSize; i++)
 	{
-		heatmap[i] = hm + SIZE*i;
+		heatmap[i] = hm + heatmapSize*i;
 	}
-	for (int i = 0; i < SCALED_SIZE; i++)
+	for (int i = 0; i < scaledSize; i++)
 	{
-		scaled_heatmap[i] = shm + SCALED_SIZE*i;
-		blurred_heatmap[i] = bhm + SCALED_SIZE*i;
+		scaled_heatmap[i] = shm + scaledSize*i;
+		blurred_heatmap[i] = bhm + scaledSize*i;
 	}
+	heatmapRenderedTick = -1;
 }
 
-// Updates the heatmap according to the agent positions
-void Ped::Model::updateHeatmapSeq()
+// Releases the heatmap buffers (if any)
+void Ped::Model::freeHeatmapSeq()
 {
-	for (int x = 0; x < SIZE; x++)
+	if (heatmap == NULL)
 	{
-		for (int y = 0; y < SIZE; y++)
-		{
-			// heat fades
-			heatmap[y][x] = (int)round(heatmap[y][x] * 0.80);
-		}
+		return;
 	}
 
-	// Count how many agents want to go to each location
-	for (int i = 0; i < agents.size(); i++)
-	{
-		Ped::Tagent* agent = agents[i];
-		int x = agent->getDesiredX();
-		int y = agent->getDesiredY();
+	free(heatmap[0]);
+	free(scaled_heatmap[0]);
+	free(blurred_heatmap[0]);
+	free(heatmap);
+	free(scaled_heatmap);
+	free(blurred_heatmap);
 
-		if (x < 0 || x >= SIZE || y < 0 || y >= SIZE)
-		{
-			continue;
-		}
+	heatmap = NULL;
+	scaled_heatmap = NULL;
+	blurred_heatmap = NULL;
+}
 
-		// intensify heat for better color results
-		heatmap[y][x] += 40;
+// Lets the heat of the previous ticks fade. The new heat (agents'
+// desired positions) is then added by the fused pass in ped_fields.cpp.
+void Ped::Model::decayHeatmapSeq()
+{
+	const int size = heatmapSize;
 
+	for (int x = 0; x < size; x++)
+	{
+		for (int y = 0; y < size; y++)
+		{
+			// heat fades
+			heatmap[y][x] = (int)round(heatmap[y][x] * heatmapDecay);
+		}
 	}
+}
+
+// Clamps the heat after the scatter, and hands the frame to the
+// exporter, which copies it
+void Ped::Model::clampHeatmapSeq()
+{
+	const int size = heatmapSize;
 
-	for (int x = 0; x < SIZE; x++)
+	for (int x = 0; x < size; x++)
 	{
-		for (int y = 0; y < SIZE; y++)
+		for (int y = 0; y < size; y++)
 		{
 			heatmap[y][x] = heatmap[y][x] < 255 ? heatmap[y][x] : 255;
 		}
 	}
 
+	if (heatmapExporter != NULL && tickCount % heatmapExportEvery == 0)
+	{
+		heatmapExporter->pushFrame(tickCount, heatmap);
+	}
+}
+
+// Scales the heat up for visual representation
+void Ped::Model::scaleHeatmapSeq() const
+{
+	const int size = heatmapSize;
+	const int cellSize = heatmapCellSize;
+
 	// Scale the data for visual representation
-	for (int y = 0; y < SIZE; y++)
+	for (int y = 0; y < size; y++)
 	{
-		for (int x = 0; x < SIZE; x++)
+		for (int x = 0; x < size; x++)
 		{
 			int value = heatmap[y][x];
-			for (int cellY = 0; cellY < CELLSIZE; cellY++)
+			for (int cellY = 0; cellY < cellSize; cellY++)
 			{
-				for (int cellX = 0; cellX < CELLSIZE; cellX++)
+				for (int cellX = 0; cellX < cellSize; cellX++)
 				{
-					scaled_heatmap[y * CELLSIZE + cellY][x * CELLSIZE + cellX] = value;
+					scaled_heatmap[y * cellSize + cellY][x * cellSize + cellX] = value;
 				}
 			}
 		}
 	}
+}
+
+// Blurs the scaled heatmap into the final image
+void Ped::Model::blurHeatmapSeq() const
+{
+	const int scaledSize = heatmapSize*heatmapCellSize;
 
 	// Weights for blur filter
 	const int w[5][5] = {
@@ -99,9 +180,9 @@ void Ped::Model::updateHeatmapSeq()
 
 #define WEIGHTSUM 273
 	// Apply gaussian blurfilter		       
-	for (int i = 2; i < SCALED_SIZE - 2; i++)
+	for (int i = 2; i < scaledSize - 2; i++)
 	{
-		for (int j = 2; j < SCALED_SIZE - 2; j++)
+		for (int j = 2; j < scaledSize - 2; j++)
 		{
 			int sum = 0;
 			for (int k = -2; k < 3; k++)
@@ -117,6 +198,22 @@ void Ped::Model::updateHeatmapSeq()
 	}
 }
 
+// The view image is only scaled and blurred when someone looks at it,
+// once per tick
+int const * const * Ped::Model::getHeatmap() const
+{
+	if (heatmap != NULL && heatmapRenderedTick != tickCount)
+	{
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_HEATMAP);
+		scaleHeatmapSeq();
+		blurHeatmapSeq();
+		heatmapRenderedTick = tickCount;
+	}
+	return blurred_heatmap;
+}
+
 int Ped::Model::getHeatmapSize() const {
-	return SCALED_SIZE;
+	// Size the heatmap has (or would have, once enabled) in view pixels
+	int size = heatmap != NULL ? heatmapSize : std::max(extentX, extentY);
+	return size*heatmapCellSize;
 }
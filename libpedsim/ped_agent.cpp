@@ -14,27 +14,58 @@
 #include <iostream>
 
 Ped::Tagent::Tagent(int posX, int posY) {
+	x = (int *) malloc(sizeof(int));
+	y = (int *) malloc(sizeof(int));
+	ownsCoordinates = true;
 	Ped::Tagent::init(posX, posY);
 }
 
-Ped::Tagent::Tagent(double posX, double posY) {
-	Ped::Tagent::init((int)round(posX), (int)round(posY));
+Ped::Tagent::Tagent(double posX, double posY) : Tagent((int)round(posX), (int)round(posY)) {
+}
+
+Ped::Tagent::Tagent(int* sharedX, int* sharedY) {
+	x = sharedX;
+	y = sharedY;
+	ownsCoordinates = false;
+	Ped::Tagent::init(*sharedX, *sharedY);
+}
+
+Ped::Tagent::~Tagent() {
+	if (ownsCoordinates) {
+		free(x);
+		free(y);
+	}
+	if (ownsRoute) {
+		free(route);
+	}
 }
 
 void Ped::Tagent::init(int posX, int posY) {
-	x = (int *) malloc(sizeof(int));
-	y = (int *) malloc(sizeof(int));
 	*x = posX;
 	*y = posY;
+	route = NULL;
+	routeLength = 0;
+	routeCapacity = 0;
+	routeHead = 0;
+	ownsRoute = false;
 	destination = NULL;
 	lastDestination = NULL;
+	desiredPositionX = posX;
+	desiredPositionY = posY;
+	moveOutcome = Ped::MOVED;
+	arrived = false;
+	lastX = posX;
+	lastY = posY;
 }
 
 void Ped::Tagent::reallocate_coordinates(int* newX, int* newY) {
-	free(x);
-	free(y);
+	if (ownsCoordinates) {
+		free(x);
+		free(y);
+	}
 	x = newX;
 	y = newY;
+	ownsCoordinates = false;
 }
 
 void Ped::Tagent::computeNextDesiredPosition() {
@@ -53,7 +84,49 @@ void Ped::Tagent::computeNextDesiredPosition() {
 }
 
 void Ped::Tagent::addWaypoint(Twaypoint* wp) {
-	waypoints.push_back(wp);
+	if (!ownsRoute || routeLength == routeCapacity) {
+		// Move the queue, in order, to a larger array of our own
+		size_t capacity = routeLength < 4 ? 4 : 2 * routeLength;
+		Twaypoint** grown = (Twaypoint**) malloc(capacity * sizeof(Twaypoint*));
+		for (size_t i = 0; i < routeLength; i++) {
+			grown[i] = getWaypoint(i);
+		}
+		if (ownsRoute) {
+			free(route);
+		}
+		route = grown;
+		routeCapacity = capacity;
+		routeHead = 0;
+		ownsRoute = true;
+	}
+	route[(routeHead + routeLength) % routeCapacity] = wp;
+	routeLength++;
+}
+
+void Ped::Tagent::setRoute(Twaypoint** sharedRoute, size_t length) {
+	if (ownsRoute) {
+		free(route);
+	}
+	route = sharedRoute;
+	routeLength = length;
+	routeCapacity = length;
+	routeHead = 0;
+	ownsRoute = false;
+}
+
+deque<Ped::Twaypoint*> Ped::Tagent::getWaypoints() const {
+	deque<Twaypoint*> waypoints;
+	for (size_t i = 0; i < routeLength; i++) {
+		waypoints.push_back(getWaypoint(i));
+	}
+	return waypoints;
+}
+
+Ped::Twaypoint* Ped::Tagent::rotateRoute(Twaypoint* last) {
+	Twaypoint* first = route[routeHead];
+	route[(routeHead + routeLength) % routeCapacity] = last;
+	routeHead = (routeHead + 1) % routeCapacity;
+	return first;
 }
 
 Ped::Twaypoint* Ped::Tagent::getNextDestination() {
@@ -68,12 +141,11 @@ Ped::Twaypoint* Ped::Tagent::getNextDestination() {
 		agentReachedDestination = length < destination->getr();
 	}
 
-	if ((agentReachedDestination || destination == NULL) && !waypoints.empty()) {
+	if ((agentReachedDestination || destination == NULL) && routeLength > 0) {
 		// Case 1: agent has reached destination (or has no current destination);
 		// get next destination if available
-		waypoints.push_back(destination);
-		nextDestination = waypoints.front();
-		waypoints.pop_front();
+		arrived = agentReachedDestination;
+		nextDestination = rotateRoute(destination);
 	}
 	else {
 		// Case 2: agent has not yet reached destination, continue to move towards
@@ -89,10 +161,14 @@ Ped::Twaypoint* Ped::Tagent::getNextDestinationSpecial() {
 		while(nextDestination == NULL) {
 
 			if(destination != NULL){
-				waypoints.push_back(destination);
+				arrived = true;
+				nextDestination = rotateRoute(destination);
+			}
+			else {
+				nextDestination = route[routeHead];
+				routeHead = (routeHead + 1) % routeCapacity;
+				routeLength--;
 			}
-			nextDestination = waypoints.front();
-			waypoints.pop_front();
 		}
 		return nextDestination;
 }
\ No newline at end of file
@@ -25,11 +25,20 @@ using namespace std;
 namespace Ped {
 	class Twaypoint;
 
+	// What Model::move() did with the agent in the last tick
+	enum MOVE_OUTCOME { MOVED, MOVED_ALTERNATIVE, BACKED_OFF, BLOCKED };
+
 	class Tagent {
 	public:
 		Tagent(int posX, int posY);
 		Tagent(double posX, double posY);
 
+		// Uses the given storage for the position instead of allocating
+		// its own (e.g. a column of a mapped scenario image)
+		Tagent(int* sharedX, int* sharedY);
+
+		~Tagent();
+
 		// Reallocate coordinates in Memory
 		void reallocate_coordinates(int* newX, int* newY);
 
@@ -62,7 +71,39 @@ namespace Ped {
 		Twaypoint* getDest() const { return destination; }	  
 		void setDest(Twaypoint* dest) { destination = dest; }
  	
-		deque<Twaypoint*> getWaypoints() const {return waypoints;}
+		deque<Twaypoint*> getWaypoints() const;
+
+		// The remaining waypoints without copying them: the i-th is
+		// visited i+1 destinations from now
+		size_t getWaypointCount() const { return routeLength; }
+		Twaypoint* getWaypoint(size_t i) const { return route[(routeHead + i) % routeCapacity]; }
+		void clearWaypoints() { routeLength = 0; routeHead = 0; }
+
+		// Uses the given storage for the waypoints instead of allocating
+		// its own (e.g. one array for the routes of all agents). Adding a
+		// waypoint later moves the route to storage of its own.
+		void setRoute(Twaypoint** sharedRoute, size_t length);
+
+		// The bytes allocated for the route (0 for a shared route)
+		size_t getRouteBytes() const { return ownsRoute ? routeCapacity * sizeof(Twaypoint*) : 0; }
+
+		// Where the position is stored, for bulk copies of many agents
+		const int * getXStorage() const { return x; }
+		const int * getYStorage() const { return y; }
+
+		// Outcome of the last move (set by Model::move)
+		MOVE_OUTCOME getMoveOutcome() const { return moveOutcome; }
+		void setMoveOutcome(MOVE_OUTCOME outcome) { moveOutcome = outcome; }
+
+		// True if the agent reached a waypoint since the flag was last cleared
+		bool hasArrived() const { return arrived; }
+		void clearArrived() { arrived = false; }
+
+		// Position at the time of the last call to savePosition(),
+		// used to derive the agent's velocity
+		int getLastX() const { return lastX; }
+		int getLastY() const { return lastY; }
+		void savePosition() { lastX = *x; lastY = *y; }
 
 		bool operator < (const Ped::Tagent& agent) const {
 			return (*x < agent.getX());
@@ -76,6 +117,9 @@ namespace Ped {
 		int* x;
 		int* y;
 
+		// Whether x and y were allocated by the agent itself
+		bool ownsCoordinates;
+
 		// The agent's desired next position
 		int desiredPositionX;
 		int desiredPositionY;
@@ -83,10 +127,26 @@ namespace Ped {
 		// The last destination
 		Twaypoint* lastDestination;
 
-		// The queue of all destinations that this agent still has to visit
-		deque<Twaypoint*> waypoints;
-
-		// Internal init function 
+		// Bookkeeping for the crowd analytics in Model
+		MOVE_OUTCOME moveOutcome;
+		bool arrived;
+		int lastX;
+		int lastY;
+
+		// The queue of all destinations that this agent still has to
+		// visit: a ring of routeLength waypoints starting at routeHead.
+		// Visited waypoints go back to the end of the queue, so the
+		// length only changes when waypoints are added.
+		Twaypoint** route;
+		size_t routeLength;
+		size_t routeCapacity;
+		size_t routeHead;
+		bool ownsRoute;
+
+		// Takes the first waypoint of the queue and appends last
+		Twaypoint* rotateRoute(Twaypoint* last);
+
+		// Internal init function, does not allocate
 		void init(int posX, int posY);
 
 		// Returns the next destination to visit
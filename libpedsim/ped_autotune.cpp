@@ -0,0 +1,280 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// The AUTO implementation. setup() runs a few timed ticks of SEQ and
+// of OMP with every region count on a copy of the scenario and
+// continues with the fastest. Only these two resolve collisions;
+// SIMD, CTHREADS and CUDA skip move() and so simulate a different
+// crowd. Both search the neighbors of an agent among all agents, so
+// a tick grows with the square of the crowd; large scenarios are
+// timed on a copy of their first agents.
+// OMP runs one thread per region (tick() sizes the team to the
+// regions), so its region size and thread count are one setting: the
+// trials try region counts, and n regions of 1/n of the agents each
+// are n threads. Other partitions of the same thread count can not be
+// expressed and are not searched.
+// The choice is kept in a cache file, keyed by the host and a
+// fingerprint of the scenario, so the trials only run the first time
+// a scenario is set up on a machine.
+//
+#include "ped_model.h"
+#include "ped_waypoint.h"
+#include "ped_util.h"
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <omp.h>
+
+// Ticks timed per trial, after one warmup tick. A trial stops early
+// once it has used its time budget (seconds).
+static const int AUTOTUNE_TICKS = 5;
+static const double AUTOTUNE_BUDGET = 0.25;
+
+// A trial whose warmup tick already takes this many times as long as
+// the best trial so far is not timed any further
+static const double AUTOTUNE_CUTOFF = 4.0;
+
+// The trials run on at most this many agents, and the fingerprint
+// hashes the routes of at most this many
+static const size_t AUTOTUNE_AGENTS = 4096;
+static const size_t FINGERPRINT_AGENTS = 4096;
+
+struct AutotuneCandidate {
+	Ped::IMPLEMENTATION implementation;
+	int threads;
+	float regionFraction;
+};
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char*) data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static uint64_t hashWaypoint(uint64_t hash, const Ped::Twaypoint *waypoint)
+{
+	double values[3] = { waypoint->getx(), waypoint->gety(), waypoint->getr() };
+	return fnv1a(hash, values, sizeof(values));
+}
+
+// The number of agents, the positions and routes of an evenly spread
+// sample of them, and the waypoints
+static uint64_t scenarioFingerprint(const std::vector<Ped::Tagent*> &agents, const std::vector<Ped::Twaypoint*> &destinations)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+	const size_t count = agents.size();
+	hash = fnv1a(hash, &count, sizeof(count));
+	const size_t stride = std::max<size_t>(1, count / FINGERPRINT_AGENTS);
+	for (size_t i = 0; i < count; i += stride)
+	{
+		const Ped::Tagent *agent = agents[i];
+		int position[3] = { agent->getX(), agent->getY(), (int) agent->getWaypointCount() };
+		hash = fnv1a(hash, position, sizeof(position));
+		for (size_t w = 0; w < agent->getWaypointCount(); w++)
+		{
+			hash = hashWaypoint(hash, agent->getWaypoint(w));
+		}
+	}
+	for (const Ped::Twaypoint *destination : destinations)
+	{
+		hash = hashWaypoint(hash, destination);
+	}
+	return hash;
+}
+
+// The cache: one "key<TAB>implementation threads fraction" line per
+// scenario. CUDA is no candidate, so the key does not ask for it (which
+// would set up the CUDA runtime).
+static std::string autotuneKey(uint64_t fingerprint, size_t agents)
+{
+	char key[512];
+	snprintf(key, sizeof(key), "%s|%u|%zu|%016llx", Ped::hostName().c_str(), std::thread::hardware_concurrency(),
+		agents, (unsigned long long) fingerprint);
+	return key;
+}
+
+static bool parseCandidate(const std::string &value, AutotuneCandidate &candidate)
+{
+	std::istringstream stream(value);
+	std::string name;
+	stream >> name >> candidate.threads >> candidate.regionFraction;
+	return stream && Ped::parseImplementation(name.c_str(), candidate.implementation)
+		&& (candidate.implementation == Ped::SEQ || candidate.implementation == Ped::OMP)
+		&& candidate.threads > 0 && candidate.regionFraction > 0.0f && candidate.regionFraction <= 1.0f;
+}
+
+// Copies the agents (with their routes) and the waypoints, for a
+// trial model to own
+static void copyScenario(const std::vector<Ped::Tagent*> &agents, const std::vector<Ped::Twaypoint*> &destinations,
+	std::vector<Ped::Tagent*> &agentsCopy, std::vector<Ped::Twaypoint*> &destinationsCopy)
+{
+	std::map<const Ped::Twaypoint*, Ped::Twaypoint*> copies;
+	auto copy = [&](const Ped::Twaypoint *waypoint) -> Ped::Twaypoint* {
+		if (waypoint == NULL)
+		{
+			return NULL;
+		}
+		Ped::Twaypoint *&waypointCopy = copies[waypoint];
+		if (waypointCopy == NULL)
+		{
+			waypointCopy = new Ped::Twaypoint(waypoint->getx(), waypoint->gety(), waypoint->getr());
+			destinationsCopy.push_back(waypointCopy);
+		}
+		return waypointCopy;
+	};
+
+	for (const Ped::Twaypoint *destination : destinations)
+	{
+		copy(destination);
+	}
+	for (const Ped::Tagent *agent : agents)
+	{
+		Ped::Tagent *agentCopy = new Ped::Tagent(agent->getX(), agent->getY());
+		for (size_t w = 0; w < agent->getWaypointCount(); w++)
+		{
+			agentCopy->addWaypoint(copy(agent->getWaypoint(w)));
+		}
+		agentCopy->setDest(copy(agent->getDest()));
+		agentsCopy.push_back(agentCopy);
+	}
+}
+
+// "SEQ", "OMP with 8 regions"
+static std::string describe(Ped::IMPLEMENTATION implementation, int threads)
+{
+	std::ostringstream text;
+	text << Ped::implementationName(implementation);
+	if (implementation == Ped::OMP)
+	{
+		text << " with " << threads << " regions";
+	}
+	return text.str();
+}
+
+// Mean tick time (seconds) of a candidate on a copy of the scenario
+static double runTrial(const AutotuneCandidate &candidate, const std::vector<Ped::Tagent*> &agents,
+	const std::vector<Ped::Twaypoint*> &destinations, double best)
+{
+	std::vector<Ped::Tagent*> trialAgents;
+	std::vector<Ped::Twaypoint*> trialDestinations;
+	copyScenario(agents, destinations, trialAgents, trialDestinations);
+
+	Ped::Model trial;
+	trial.setRegionFraction(candidate.regionFraction);
+	trial.setup(trialAgents, trialDestinations, candidate.implementation, candidate.threads);
+
+	auto start = std::chrono::steady_clock::now();
+	trial.tick();
+	double warmup = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (warmup > best * AUTOTUNE_CUTOFF)
+	{
+		return warmup;
+	}
+
+	double total = 0.0;
+	int ticks = 0;
+	while (ticks < AUTOTUNE_TICKS && total < AUTOTUNE_BUDGET)
+	{
+		start = std::chrono::steady_clock::now();
+		trial.tick();
+		total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		ticks++;
+	}
+	return total / ticks;
+}
+
+void Ped::Model::autotune(const std::vector<Tagent*> &agentsInScenario, const std::vector<Twaypoint*> &destinationsInScenario)
+{
+	implementation = Ped::SEQ;
+	number_of_threads = 1;
+	if (agentsInScenario.empty())
+	{
+		return;
+	}
+
+	const std::string key = autotuneKey(scenarioFingerprint(agentsInScenario, destinationsInScenario), agentsInScenario.size());
+	std::map<std::string, std::string> cache;
+	if (!autotuneCache.empty())
+	{
+		cache = readCacheFile(autotuneCache);
+		auto cached = cache.find(key);
+		AutotuneCandidate candidate;
+		if (cached != cache.end() && parseCandidate(cached->second, candidate))
+		{
+			implementation = candidate.implementation;
+			number_of_threads = candidate.threads;
+			regionFraction = candidate.regionFraction;
+			std::cout << "Note: AUTO uses " << describe(implementation, number_of_threads) << " (cached in " << autotuneCache << ")." << std::endl;
+			return;
+		}
+	}
+
+	const std::vector<Tagent*> trialAgents(agentsInScenario.begin(),
+		agentsInScenario.begin() + std::min(agentsInScenario.size(), AUTOTUNE_AGENTS));
+
+	// Region counts: powers of two up to twice the hardware threads,
+	// and the hardware threads themselves
+	const int hardware = std::max(1u, std::thread::hardware_concurrency());
+	std::set<int> threadCounts;
+	for (int threads = 2; threads <= 2 * hardware; threads *= 2)
+	{
+		threadCounts.insert(threads);
+	}
+	threadCounts.insert(hardware);
+
+	// OMP first, so a slow SEQ trial is cut off after its warmup tick
+	std::vector<AutotuneCandidate> candidates;
+	for (int threads : threadCounts)
+	{
+		// Every region needs at least one agent
+		if (trialAgents.size() >= (size_t) threads)
+		{
+			candidates.push_back({ Ped::OMP, threads, 1.0f / threads });
+		}
+	}
+	candidates.push_back({ Ped::SEQ, 1, regionFraction });
+
+	// Trials on OMP change the number of OpenMP threads
+	const int ompThreads = omp_get_max_threads();
+	auto start = std::chrono::steady_clock::now();
+	double best = 1e30;
+	AutotuneCandidate winner = candidates[0];
+	for (const AutotuneCandidate &candidate : candidates)
+	{
+		double tickTime = runTrial(candidate, trialAgents, destinationsInScenario, best);
+		if (tickTime < best)
+		{
+			best = tickTime;
+			winner = candidate;
+		}
+	}
+	omp_set_num_threads(ompThreads);
+
+	implementation = winner.implementation;
+	number_of_threads = winner.threads;
+	regionFraction = winner.regionFraction;
+	std::cout << "Note: AUTO uses " << describe(implementation, number_of_threads) << " ("
+		<< candidates.size() << " trials in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+		<< " s)." << std::endl;
+
+	if (!autotuneCache.empty())
+	{
+		std::ostringstream value;
+		value << implementationName(implementation) << " " << number_of_threads << " " << regionFraction;
+		cache[key] = value.str();
+		if (!writeCacheFile(autotuneCache, cache))
+		{
+			std::cout << "Note: could not write autotune cache " << autotuneCache << "." << std::endl;
+		}
+	}
+}
@@ -0,0 +1,409 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Checkpoint and restore of the model state, see ped_checkpoint.h
+//
+#include "ped_checkpoint.h"
+#include "ped_model.h"
+#include "ped_waypoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <algorithm>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char CHECKPOINT_MAGIC[8] = "PEDCKP1";
+
+static uint64_t align64(uint64_t offset)
+{
+	return (offset + 63) & ~(uint64_t) 63;
+}
+
+Ped::CheckpointWriter::CheckpointWriter(const char *filename) :
+	filename(filename), written(0), skipped(0), busy(false), stopping(false)
+{
+	writer = std::thread(&Ped::CheckpointWriter::writerLoop, this);
+}
+
+Ped::CheckpointWriter::~CheckpointWriter()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_one();
+	writer.join();
+
+	if (skipped > 0)
+	{
+		std::cout << "Note: skipped " << skipped.load() << " checkpoints while the previous one was being written." << std::endl;
+	}
+}
+
+Ped::CheckpointState * Ped::CheckpointWriter::acquire()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (busy)
+	{
+		skipped++;
+		return NULL;
+	}
+	return &spare;
+}
+
+void Ped::CheckpointWriter::submit()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		// Swapping vectors only swaps pointers: the old buffers are reused next time
+		std::swap(spare, pending);
+		busy = true;
+	}
+	wakeup.notify_one();
+}
+
+void Ped::CheckpointWriter::writerLoop()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (true)
+	{
+		wakeup.wait(guard, [this] { return busy || stopping; });
+		if (busy)
+		{
+			// pending is not touched by the tick loop while busy
+			guard.unlock();
+			bool ok = write(filename, pending);
+			guard.lock();
+			if (ok)
+			{
+				written++;
+			}
+			else
+			{
+				std::cerr << "Warning: could not write checkpoint " << filename << "." << std::endl;
+			}
+			busy = false;
+		}
+		else if (stopping)
+		{
+			return;
+		}
+	}
+}
+
+void Ped::CheckpointWriter::layout(const CheckpointHeader &h, uint64_t offsets[6], uint64_t &size)
+{
+	offsets[0] = align64(sizeof(CheckpointHeader));
+	offsets[1] = align64(offsets[0] + h.agentCount * sizeof(int32_t));
+	offsets[2] = align64(offsets[1] + h.agentCount * sizeof(int32_t));
+	offsets[3] = align64(offsets[2] + h.agentCount * sizeof(uint32_t));
+	offsets[4] = align64(offsets[3] + (h.agentCount + 1) * sizeof(uint32_t));
+	offsets[5] = align64(offsets[4] + h.routeLength * sizeof(uint32_t));
+	size = offsets[5] + (uint64_t) h.heatmapSize * h.heatmapSize * sizeof(int32_t);
+}
+
+bool Ped::CheckpointWriter::write(const std::string &filename, const CheckpointState &state)
+{
+	CheckpointHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	h.version = VERSION;
+	h.heatmapSize = state.heatmapSize;
+	h.tick = state.tick;
+	h.agentCount = state.x.size();
+	h.waypointCount = state.waypointCount;
+	h.routeLength = state.route.size();
+
+	uint64_t offsets[6], size;
+	layout(h, offsets, size);
+
+	const std::string tmp = filename + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	const void *columns[6] = { state.x.data(), state.y.data(), state.destination.data(),
+		state.routeStart.data(), state.route.data(), state.heatmap.data() };
+	const uint64_t bytes[6] = { h.agentCount * sizeof(int32_t), h.agentCount * sizeof(int32_t),
+		h.agentCount * sizeof(uint32_t), (h.agentCount + 1) * sizeof(uint32_t),
+		h.routeLength * sizeof(uint32_t), (uint64_t) h.heatmapSize * h.heatmapSize * sizeof(int32_t) };
+
+	static const char padding[64] = { 0 };
+	bool ok = fwrite(&h, sizeof(h), 1, file) == 1;
+	uint64_t position = sizeof(h);
+	for (int c = 0; c < 6 && ok; c++)
+	{
+		ok = fwrite(padding, 1, offsets[c] - position, file) == offsets[c] - position
+			&& fwrite(columns[c], 1, bytes[c], file) == bytes[c];
+		position = offsets[c] + bytes[c];
+	}
+
+	// On disk before it replaces the previous checkpoint
+	ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), filename.c_str()) != 0)
+	{
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Starts writing a checkpoint to filename every Nth tick
+void Ped::Model::enableCheckpoints(const char *filename, int everyNthTick)
+{
+	delete checkpointWriter;
+	checkpointWriter = new Ped::CheckpointWriter(filename);
+	checkpointEvery = everyNthTick > 0 ? everyNthTick : 1;
+}
+
+// Called at the end of every tick
+void Ped::Model::saveCheckpointIfDue()
+{
+	if (checkpointWriter == NULL || tickCount % checkpointEvery != 0)
+	{
+		return;
+	}
+	Ped::CheckpointState *state = checkpointWriter->acquire();
+	if (state != NULL)
+	{
+		captureCheckpoint(*state);
+		checkpointWriter->submit();
+	}
+}
+
+bool Ped::Model::writeCheckpoint(const char *filename) const
+{
+	Ped::CheckpointState state;
+	captureCheckpoint(state);
+	return Ped::CheckpointWriter::write(filename, state);
+}
+
+void Ped::Model::captureCheckpoint(Ped::CheckpointState &state) const
+{
+	const size_t n = agents.size();
+
+	std::unordered_map<const Ped::Twaypoint*, uint32_t> waypointIndex;
+	for (size_t i = 0; i < destinations.size(); i++)
+	{
+		waypointIndex[destinations[i]] = (uint32_t) i;
+	}
+	auto indexOf = [&waypointIndex](const Ped::Twaypoint *waypoint) {
+		auto it = waypointIndex.find(waypoint);
+		return it != waypointIndex.end() ? it->second : Ped::CHECKPOINT_NONE;
+	};
+
+	state.tick = tickCount;
+	state.waypointCount = destinations.size();
+	state.x.resize(n);
+	state.y.resize(n);
+	state.destination.resize(n);
+	state.routeStart.resize(n + 1);
+
+	// Positions, destinations and route lengths
+	state.routeStart[0] = 0;
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < n; i++)
+	{
+		state.x[i] = agents[i]->getX();
+		state.y[i] = agents[i]->getY();
+		state.destination[i] = indexOf(agents[i]->getDest());
+		state.routeStart[i + 1] = (uint32_t) agents[i]->getWaypointCount();
+	}
+	for (size_t i = 0; i < n; i++)
+	{
+		state.routeStart[i + 1] += state.routeStart[i];
+	}
+
+	// The remaining waypoints, in queue order
+	state.route.resize(state.routeStart[n]);
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < n; i++)
+	{
+		uint32_t r = state.routeStart[i];
+		for (size_t w = 0; w < agents[i]->getWaypointCount(); w++)
+		{
+			state.route[r++] = indexOf(agents[i]->getWaypoint(w));
+		}
+	}
+
+	state.heatmapSize = heatmap != NULL ? heatmapSize : 0;
+	state.heatmap.resize((size_t) state.heatmapSize * state.heatmapSize);
+	if (heatmap != NULL)
+	{
+		memcpy(state.heatmap.data(), heatmap[0], state.heatmap.size() * sizeof(int32_t));
+	}
+}
+
+// The routes have to lie within the route column and lead to existing
+// waypoints. The only CHECKPOINT_NONE a model writes into a route is
+// the one placeholder of the agent's first destination (the queue cycles
+// it along with the waypoints), next to a real current destination.
+static bool validCheckpointRoutes(const Ped::CheckpointHeader &h, const uint32_t *destination,
+	const uint32_t *routeStart, const uint32_t *route)
+{
+	const int64_t n = (int64_t) h.agentCount;
+	const uint32_t waypoints = (uint32_t) h.waypointCount;
+	if (routeStart[0] != 0 || routeStart[n] != h.routeLength)
+	{
+		return false;
+	}
+
+	// Monotonic route starts keep every route within the column
+	int broken = 0;
+	#pragma omp parallel for schedule(static) reduction(|:broken)
+	for (int64_t i = 0; i < n; i++)
+	{
+		broken |= routeStart[i] > routeStart[i + 1] || (destination[i] >= waypoints && destination[i] != Ped::CHECKPOINT_NONE);
+	}
+	if (broken)
+	{
+		return false;
+	}
+
+	#pragma omp parallel for schedule(static) reduction(|:broken)
+	for (int64_t i = 0; i < n; i++)
+	{
+		uint32_t none = 0;
+		for (uint32_t r = routeStart[i]; r < routeStart[i + 1]; r++)
+		{
+			if (route[r] == Ped::CHECKPOINT_NONE)
+			{
+				none++;
+			}
+			else if (route[r] >= waypoints)
+			{
+				broken = 1;
+			}
+		}
+		if (none > 1 || (none == 1 && destination[i] == Ped::CHECKPOINT_NONE))
+		{
+			broken = 1;
+		}
+	}
+	return !broken;
+}
+
+bool Ped::Model::restoreCheckpoint(const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(Ped::CheckpointHeader))
+	{
+		std::cout << "Warning: checkpoint not found or invalid: " << filename << "." << std::endl;
+		if (fd >= 0) close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		std::cout << "Warning: could not map checkpoint " << filename << "." << std::endl;
+		return false;
+	}
+
+	const char *base = (const char*) data;
+	const Ped::CheckpointHeader *h = (const Ped::CheckpointHeader*) base;
+	uint64_t offsets[6], size = 0;
+	// Counts that keep the layout from overflowing
+	bool valid = memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 && h->version == Ped::CheckpointWriter::VERSION
+		&& h->agentCount < UINT32_MAX && h->waypointCount < UINT32_MAX && h->routeLength <= UINT32_MAX && h->heatmapSize <= 65536;
+	if (valid)
+	{
+		Ped::CheckpointWriter::layout(*h, offsets, size);
+		valid = size <= (uint64_t) info.st_size;
+	}
+	if (!valid)
+	{
+		std::cout << "Warning: ignoring invalid or outdated checkpoint " << filename << "." << std::endl;
+		munmap(data, info.st_size);
+		return false;
+	}
+	if (h->agentCount != agents.size() || h->waypointCount != destinations.size())
+	{
+		std::cout << "Warning: checkpoint " << filename << " was written for another scenario ("
+			<< h->agentCount << " agents, " << h->waypointCount << " waypoints)." << std::endl;
+		munmap(data, info.st_size);
+		return false;
+	}
+
+	const int32_t *xs = (const int32_t*) (base + offsets[0]);
+	const int32_t *ys = (const int32_t*) (base + offsets[1]);
+	const uint32_t *destination = (const uint32_t*) (base + offsets[2]);
+	const uint32_t *routeStart = (const uint32_t*) (base + offsets[3]);
+	const uint32_t *route = (const uint32_t*) (base + offsets[4]);
+	const int32_t *heat = (const int32_t*) (base + offsets[5]);
+
+	if (!validCheckpointRoutes(*h, destination, routeStart, route))
+	{
+		std::cout << "Warning: ignoring checkpoint " << filename << " with invalid routes." << std::endl;
+		munmap(data, info.st_size);
+		return false;
+	}
+
+	// The heatmap first: it is the only step that can still fail (e.g.
+	// while it is exported with another size), and a failed restore
+	// leaves the model as it was
+	if (h->heatmapSize > 0)
+	{
+		if ((heatmap == NULL || heatmapSize != (int) h->heatmapSize)
+			&& !enableHeatmap(h->heatmapSize, heatmapCellSize, heatmapDecay))
+		{
+			std::cout << "Warning: could not restore the heatmap of checkpoint " << filename << "." << std::endl;
+			munmap(data, info.st_size);
+			return false;
+		}
+		memcpy(heatmap[0], heat, (size_t) h->heatmapSize * h->heatmapSize * sizeof(int32_t));
+	}
+
+	auto waypointAt = [this](uint32_t index) {
+		return index < destinations.size() ? destinations[index] : (Ped::Twaypoint*) NULL;
+	};
+
+	// Agents carry no identity beyond their state, so the state of the
+	// i-th agent at checkpoint time simply goes to the i-th agent now
+	const size_t n = agents.size();
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < n; i++)
+	{
+		Ped::Tagent *agent = agents[i];
+		agent->setX(xs[i]);
+		agent->setY(ys[i]);
+		agent->setDest(waypointAt(destination[i]));
+		agent->clearWaypoints();
+		for (uint32_t r = routeStart[i]; r < routeStart[i + 1]; r++)
+		{
+			agent->addWaypoint(waypointAt(route[r]));
+		}
+		agent->savePosition();
+		agent->clearArrived();
+	}
+
+	// The vectorized implementations keep their own copy of the destinations
+	if ((implementation == Ped::SIMD || implementation == Ped::CUDA) && destXarray != NULL)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			const Ped::Twaypoint *dest = agents[i]->getDest();
+			if (dest != NULL)
+			{
+				destXarray[i] = (float) dest->getx();
+				destYarray[i] = (float) dest->gety();
+				destRarray[i] = (float) dest->getr();
+			}
+			destReached[i] = 0;
+		}
+	}
+
+	tickCount = h->tick;
+	munmap(data, info.st_size);
+	return true;
+}
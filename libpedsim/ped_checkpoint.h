@@ -0,0 +1,109 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Checkpoints hold everything needed to resume a run: the tick
+// count, agent positions, current destinations, the remaining
+// waypoints of every agent and the raw heatmap. Waypoints are
+// stored as indices into the model's destinations, so a checkpoint
+// can only be restored into a model set up from the same scenario.
+//
+// The tick loop copies the state into a spare CheckpointState
+// (one parallel pass over the agents); a background thread then
+// writes it. While a write is in progress, new checkpoints are
+// skipped rather than waited for.
+//
+// File layout (little endian, columns aligned to 64 bytes):
+//   CheckpointHeader
+//   agent x, agent y          int32[agents]
+//   destination               uint32[agents]      (CHECKPOINT_NONE if none)
+//   route start               uint32[agents + 1]  (into route)
+//   route                     uint32[routeLength]
+//   heatmap                   int32[heatmapSize * heatmapSize]
+//
+#ifndef _ped_checkpoint_h_
+#define _ped_checkpoint_h_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace Ped {
+  // Waypoint index of "no waypoint"
+  static const uint32_t CHECKPOINT_NONE = 0xFFFFFFFFu;
+
+  struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t heatmapSize;
+    int64_t tick;
+    uint64_t agentCount;
+    uint64_t waypointCount;
+    uint64_t routeLength;
+  };
+
+  // A copy of the model state, in file order
+  struct CheckpointState {
+    long tick;
+    size_t waypointCount;
+    int heatmapSize;
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+    std::vector<uint32_t> destination;
+    std::vector<uint32_t> routeStart;
+    std::vector<uint32_t> route;
+    std::vector<int32_t> heatmap;
+  };
+
+  class CheckpointWriter
+  {
+  public:
+    static const uint32_t VERSION = 1;
+
+    CheckpointWriter(const char *filename);
+
+    // Waits for the checkpoint being written, if any
+    ~CheckpointWriter();
+
+    // The buffer to fill for the next checkpoint, or NULL if the
+    // previous one is still being written (the checkpoint is skipped)
+    CheckpointState * acquire();
+
+    // Hands the buffer returned by acquire() to the writer thread
+    void submit();
+
+    int getWrittenCheckpoints() const { return written; }
+    int getSkippedCheckpoints() const { return skipped; }
+
+    // Writes state to filename, atomically (temporary file + rename)
+    static bool write(const std::string &filename, const CheckpointState &state);
+
+    // Byte offsets of the columns for the given header
+    static void layout(const CheckpointHeader &h, uint64_t offsets[6], uint64_t &size);
+
+  private:
+    std::string filename;
+
+    // Read by the tick loop while the writer thread counts
+    std::atomic<int> written;
+    std::atomic<int> skipped;
+
+    // Filled by the tick loop / owned by the writer thread while busy
+    CheckpointState spare;
+    CheckpointState pending;
+
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool busy;
+    bool stopping;
+    std::thread writer;
+
+    void writerLoop();
+  };
+}
+
+#endif
@@ -0,0 +1,192 @@
+// Created for Low Level Parallel Programming 2017
+//
+// Jam detection: cells that contain blocked agents are joined into
+// clusters with a lock-free union-find over the grid. The grid is cut
+// into tiles that are processed concurrently; unions that cross a tile
+// border go through the same compare-and-swap, so no locks are needed.
+//
+#include "ped_model.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <omp.h>
+using namespace std;
+
+#define CLUSTER_TILE 64
+
+// Follows the parent links up to the root of the cluster
+static int findRoot(std::atomic<int> *parent, int i)
+{
+	int p = parent[i].load(std::memory_order_relaxed);
+	while (p != i)
+	{
+		int grandparent = parent[p].load(std::memory_order_relaxed);
+		// Path halving; losing this race is harmless
+		if (grandparent != p)
+		{
+			parent[i].compare_exchange_weak(p, grandparent, std::memory_order_relaxed);
+		}
+		i = p;
+		p = parent[i].load(std::memory_order_relaxed);
+	}
+	return i;
+}
+
+// Joins the clusters of a and b. The larger root is always linked below
+// the smaller one, and only with a CAS on a root, so concurrent unions
+// can not create cycles.
+static void unite(std::atomic<int> *parent, int a, int b)
+{
+	while (true)
+	{
+		a = findRoot(parent, a);
+		b = findRoot(parent, b);
+		if (a == b)
+		{
+			return;
+		}
+		if (a < b)
+		{
+			std::swap(a, b);
+		}
+		int expected = a;
+		if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+		{
+			return;
+		}
+	}
+}
+
+void Ped::Model::enableCongestionDetection(int minAgents)
+{
+	enableCrowdFields();
+	minClusterAgents = minAgents;
+
+	if (clusterParent == NULL)
+	{
+		clusterParent = new std::atomic<int>[extentX*extentY];
+	}
+}
+
+void Ped::Model::detectCongestion()
+{
+	const int width = extentX;
+	const int height = extentY;
+	const int tilesX = (width + CLUSTER_TILE - 1) / CLUSTER_TILE;
+	const int tilesY = (height + CLUSTER_TILE - 1) / CLUSTER_TILE;
+	std::atomic<int> *parent = clusterParent;
+
+	// Every cell with blocked agents starts as its own cluster
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < width*height; i++)
+	{
+		parent[i].store(crowdFields[i].blocked > 0 ? i : -1, std::memory_order_relaxed);
+	}
+
+	// Link each blocked cell to its blocked neighbours to the left and
+	// above. Tiles run concurrently; links across tile borders are just
+	// more CAS unions.
+	#pragma omp parallel for schedule(dynamic) collapse(2)
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			const int yEnd = std::min((ty + 1) * CLUSTER_TILE, height);
+			const int xEnd = std::min((tx + 1) * CLUSTER_TILE, width);
+			for (int y = ty * CLUSTER_TILE; y < yEnd; y++)
+			{
+				for (int x = tx * CLUSTER_TILE; x < xEnd; x++)
+				{
+					int i = y*width + x;
+					if (parent[i].load(std::memory_order_relaxed) < 0)
+					{
+						continue;
+					}
+					if (x > 0 && crowdFields[i - 1].blocked > 0)
+					{
+						unite(parent, i, i - 1);
+					}
+					if (y > 0)
+					{
+						for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); nx++)
+						{
+							int j = (y - 1)*width + nx;
+							if (crowdFields[j].blocked > 0)
+							{
+								unite(parent, i, j);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Collect size and bounding box per root, per thread, then merge
+	std::vector<std::unordered_map<int, CongestionCluster> > partial(omp_get_max_threads());
+	#pragma omp parallel
+	{
+		std::unordered_map<int, CongestionCluster> &clusters = partial[omp_get_thread_num()];
+
+		#pragma omp for schedule(static)
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				int i = y*width + x;
+				if (parent[i].load(std::memory_order_relaxed) < 0)
+				{
+					continue;
+				}
+				int root = findRoot(parent, i);
+				auto it = clusters.find(root);
+				if (it == clusters.end())
+				{
+					CongestionCluster cluster = { 0, 0, x, y, x, y };
+					it = clusters.insert(std::make_pair(root, cluster)).first;
+				}
+				CongestionCluster &cluster = it->second;
+				cluster.agents += crowdFields[i].blocked;
+				cluster.cells++;
+				cluster.x0 = std::min(cluster.x0, x);
+				cluster.y0 = std::min(cluster.y0, y);
+				cluster.x1 = std::max(cluster.x1, x);
+				cluster.y1 = std::max(cluster.y1, y);
+			}
+		}
+	}
+
+	std::unordered_map<int, CongestionCluster> merged;
+	for (const auto& clusters: partial)
+	{
+		for (const auto& entry: clusters)
+		{
+			auto it = merged.find(entry.first);
+			if (it == merged.end())
+			{
+				merged.insert(entry);
+				continue;
+			}
+			CongestionCluster &cluster = it->second;
+			cluster.agents += entry.second.agents;
+			cluster.cells += entry.second.cells;
+			cluster.x0 = std::min(cluster.x0, entry.second.x0);
+			cluster.y0 = std::min(cluster.y0, entry.second.y0);
+			cluster.x1 = std::max(cluster.x1, entry.second.x1);
+			cluster.y1 = std::max(cluster.y1, entry.second.y1);
+		}
+	}
+
+	congestionClusters.clear();
+	for (const auto& entry: merged)
+	{
+		if (entry.second.agents >= minClusterAgents)
+		{
+			congestionClusters.push_back(entry.second);
+		}
+	}
+
+	// Largest jams first
+	std::sort(congestionClusters.begin(), congestionClusters.end(),
+		[](const CongestionCluster &a, const CongestionCluster &b) { return a.agents > b.agents; });
+}
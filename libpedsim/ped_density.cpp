@@ -0,0 +1,117 @@
+// Created for Low Level Parallel Programming 2017
+//
+// Implements density queries: a summed-area table over the agent
+// occupancy grid is rebuilt once per tick, after which the number
+// of agents in any rectangle is answered with four lookups.
+//
+#include "ped_model.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <omp.h>
+using namespace std;
+
+// Allocates the occupancy grid and its summed-area table
+void Ped::Model::enableDensityQueries()
+{
+	if (densitySat != NULL)
+	{
+		return;
+	}
+
+	occupancy = (int*)calloc(extentX*extentY, sizeof(int));
+	densitySat = (int*)calloc((extentX + 1)*(extentY + 1), sizeof(int));
+
+	// From now on the occupancy is counted by the fused pass in tick(),
+	// here we fill it once so that queries work before the first tick
+	for (const auto& agent: agents)
+	{
+		int x = agent->getX();
+		int y = agent->getY();
+		if (x < 0 || x >= extentX || y < 0 || y >= extentY)
+		{
+			continue;
+		}
+		occupancy[y*extentX + x]++;
+	}
+
+	updateDensitySat();
+}
+
+// Rebuilds the summed-area table from the occupancy grid
+void Ped::Model::updateDensitySat()
+{
+	const int width = extentX;
+	const int height = extentY;
+	const int satWidth = width + 1;
+
+	// Row prefix sums: independent per row
+	#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++)
+	{
+		const int *row = &occupancy[y*width];
+		int *sat = &densitySat[(y + 1)*satWidth];
+		int sum = 0;
+		sat[0] = 0;
+		for (int x = 0; x < width; x++)
+		{
+			sum += row[x];
+			sat[x + 1] = sum;
+		}
+	}
+
+	// Column prefix sums: independent per column, so split the columns
+	// into blocks and walk each block down the rows (keeps accesses contiguous)
+	const int block = 64;
+	#pragma omp parallel for schedule(static)
+	for (int x0 = 1; x0 < satWidth; x0 += block)
+	{
+		const int x1 = std::min(x0 + block, satWidth);
+		for (int y = 2; y <= height; y++)
+		{
+			int *sat = &densitySat[y*satWidth];
+			const int *above = sat - satWidth;
+			for (int x = x0; x < x1; x++)
+			{
+				sat[x] += above[x];
+			}
+		}
+	}
+}
+
+int Ped::Model::countInRect(int x0, int y0, int x1, int y1) const
+{
+	if (densitySat == NULL)
+	{
+		return 0;
+	}
+
+	// Clip to the grid
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	x1 = std::min(x1, extentX - 1);
+	y1 = std::min(y1, extentY - 1);
+	if (x0 > x1 || y0 > y1)
+	{
+		return 0;
+	}
+
+	const int satWidth = extentX + 1;
+	return densitySat[(y1 + 1)*satWidth + x1 + 1]
+		- densitySat[y0*satWidth + x1 + 1]
+		- densitySat[(y1 + 1)*satWidth + x0]
+		+ densitySat[y0*satWidth + x0];
+}
+
+void Ped::Model::countInRects(const std::vector<Rect> &rects, std::vector<int> &counts) const
+{
+	counts.resize(rects.size());
+
+	#pragma omp parallel for schedule(static) if (rects.size() > 4096)
+	for (int i = 0; i < (int) rects.size(); i++)
+	{
+		const Rect &r = rects[i];
+		counts[i] = countInRect(r.x0, r.y0, r.x1, r.y1);
+	}
+}
@@ -0,0 +1,148 @@
+// Created for Low Level Parallel Programming 2017
+//
+// Per-tick crowd analytics. Everything that needs to look at every
+// agent after a tick (heatmap heat, occupancy for the density queries,
+// and the crowd fields) is accumulated in a single fused pass over the
+// agents, so that enabling more analytics does not add more sweeps.
+//
+#include "ped_model.h"
+#include "ped_profile.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
+using namespace std;
+
+// Allocates the crowd fields
+void Ped::Model::enableCrowdFields()
+{
+	if (crowdFields != NULL)
+	{
+		return;
+	}
+
+	crowdFields = (CrowdCell*)calloc(extentX*extentY, sizeof(CrowdCell));
+
+	// Velocities are measured from here on
+	for (const auto& agent: agents)
+	{
+		agent->savePosition();
+		agent->clearArrived();
+	}
+}
+
+// Runs the enabled analytics after a tick
+void Ped::Model::updateAgentFields()
+{
+	if (heatmap == NULL && densitySat == NULL && crowdFields == NULL)
+	{
+		return;
+	}
+
+	if (heatmap != NULL)
+	{
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_HEATMAP);
+		decayHeatmapSeq();
+	}
+
+	{
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_FIELDS);
+		accumulateAgentFields();
+	}
+
+	if (densitySat != NULL)
+	{
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_DENSITY);
+		updateDensitySat();
+	}
+
+	if (clusterParent != NULL)
+	{
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_CONGESTION);
+		detectCongestion();
+	}
+
+	if (heatmap != NULL)
+	{
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_HEATMAP);
+		clampHeatmapSeq();
+	}
+}
+
+// The fused pass: one read of every agent feeds all enabled layers
+void Ped::Model::accumulateAgentFields()
+{
+	const int width = extentX;
+	const int height = extentY;
+
+	if (occupancy != NULL)
+	{
+		memset(occupancy, 0, width*height*sizeof(int));
+	}
+	if (crowdFields != NULL)
+	{
+		memset(crowdFields, 0, width*height*sizeof(CrowdCell));
+	}
+
+	// Only worth the atomics for large crowds
+	const int n = agents.size();
+	#pragma omp parallel for schedule(static) if (n > 20000)
+	for (int i = 0; i < n; i++)
+	{
+		Ped::Tagent *agent = agents[i];
+		int x = agent->getX();
+		int y = agent->getY();
+		int desiredX = agent->getDesiredX();
+		int desiredY = agent->getDesiredY();
+
+		// Heat: count how many agents want to go to each location
+		if (heatmap != NULL && desiredX >= 0 && desiredX < heatmapSize && desiredY >= 0 && desiredY < heatmapSize)
+		{
+			// intensify heat for better color results
+			#pragma omp atomic
+			heatmap[desiredY][desiredX] += 40;
+		}
+
+		bool inside = x >= 0 && x < width && y >= 0 && y < height;
+		if (occupancy != NULL && inside)
+		{
+			#pragma omp atomic
+			occupancy[y*width + x]++;
+		}
+
+		if (crowdFields != NULL)
+		{
+			if (desiredX >= 0 && desiredX < width && desiredY >= 0 && desiredY < height)
+			{
+				#pragma omp atomic
+				crowdFields[desiredY*width + desiredX].desired++;
+			}
+			if (inside)
+			{
+				CrowdCell &cell = crowdFields[y*width + x];
+				bool blocked = agent->getMoveOutcome() == Ped::BACKED_OFF || agent->getMoveOutcome() == Ped::BLOCKED;
+				float vx = (float) (x - agent->getLastX());
+				float vy = (float) (y - agent->getLastY());
+
+				#pragma omp atomic
+				cell.agents++;
+				if (blocked)
+				{
+					#pragma omp atomic
+					cell.blocked++;
+				}
+				if (agent->hasArrived())
+				{
+					#pragma omp atomic
+					cell.arrivals++;
+				}
+				#pragma omp atomic
+				cell.sumVx += vx;
+				#pragma omp atomic
+				cell.sumVy += vy;
+			}
+			agent->savePosition();
+			agent->clearArrived();
+		}
+	}
+}
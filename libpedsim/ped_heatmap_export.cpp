@@ -0,0 +1,169 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Background writer for heatmap frames, see ped_heatmap_export.h
+//
+#include "ped_heatmap_export.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+Ped::HeatmapExporter::HeatmapExporter(const char *filename, int width, int height, int maxQueuedFrames) :
+	width(width), height(height), maxQueuedFrames(maxQueuedFrames), writtenFrames(0), droppedFrames(0), stopping(false)
+{
+	file = fopen(filename, "wb");
+	if (file == NULL)
+	{
+		std::cerr << "Warning: could not open heatmap export file " << filename << "." << std::endl;
+		return;
+	}
+
+	uint32_t dims[2] = { (uint32_t) width, (uint32_t) height };
+	fwrite("PEDHM01", 1, 8, file);
+	fwrite(dims, sizeof(uint32_t), 2, file);
+
+	// Worst case for the run-length encoding: every cell is its own run
+	encoded.resize(2 * (size_t) width * height);
+
+	writer = std::thread(&Ped::HeatmapExporter::writerLoop, this);
+}
+
+Ped::HeatmapExporter::~HeatmapExporter()
+{
+	if (file == NULL)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_one();
+	writer.join();
+
+	writeIndex();
+	fclose(file);
+
+	if (droppedFrames > 0)
+	{
+		std::cout << "Note: heatmap export dropped " << droppedFrames.load() << " frames." << std::endl;
+	}
+}
+
+bool Ped::HeatmapExporter::pushFrame(long tick, int const * const * grid)
+{
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	// Grab a buffer without holding the lock while copying
+	std::vector<unsigned char> cells;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if ((int) queue.size() >= maxQueuedFrames)
+		{
+			droppedFrames++;
+			return false;
+		}
+		if (!freeBuffers.empty())
+		{
+			cells.swap(freeBuffers.back());
+			freeBuffers.pop_back();
+		}
+	}
+
+	cells.resize((size_t) width * height);
+	unsigned char *out = cells.data();
+	for (int y = 0; y < height; y++)
+	{
+		const int *row = grid[y];
+		for (int x = 0; x < width; x++)
+		{
+			int value = row[x];
+			*out++ = (unsigned char) (value < 0 ? 0 : (value > 255 ? 255 : value));
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queue.push_back(Frame());
+		queue.back().tick = tick;
+		queue.back().cells.swap(cells);
+	}
+	wakeup.notify_one();
+	return true;
+}
+
+void Ped::HeatmapExporter::writerLoop()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (true)
+	{
+		wakeup.wait(guard, [this] { return stopping || !queue.empty(); });
+		if (queue.empty())
+		{
+			// stopping, and everything has been written
+			return;
+		}
+
+		Frame frame;
+		frame.tick = queue.front().tick;
+		frame.cells.swap(queue.front().cells);
+		queue.pop_front();
+
+		// Encode and write without blocking the tick loop
+		guard.unlock();
+		writeFrame(frame);
+		guard.lock();
+
+		freeBuffers.push_back(std::vector<unsigned char>());
+		freeBuffers.back().swap(frame.cells);
+	}
+}
+
+void Ped::HeatmapExporter::writeFrame(const Frame &frame)
+{
+	// Run-length encode as (count, value) pairs
+	const unsigned char *cells = frame.cells.data();
+	const size_t n = frame.cells.size();
+	size_t nbytes = 0;
+	size_t i = 0;
+	while (i < n)
+	{
+		unsigned char value = cells[i];
+		size_t run = 1;
+		while (i + run < n && run < 255 && cells[i + run] == value)
+		{
+			run++;
+		}
+		encoded[nbytes++] = (unsigned char) run;
+		encoded[nbytes++] = value;
+		i += run;
+	}
+
+	index.push_back(std::make_pair(frame.tick, ftell(file)));
+
+	int64_t tick = frame.tick;
+	uint32_t size = (uint32_t) nbytes;
+	fwrite(&tick, sizeof(tick), 1, file);
+	fwrite(&size, sizeof(size), 1, file);
+	fwrite(encoded.data(), 1, nbytes, file);
+	writtenFrames++;
+}
+
+void Ped::HeatmapExporter::writeIndex()
+{
+	for (const auto& entry: index)
+	{
+		int64_t tick = entry.first;
+		uint64_t offset = entry.second;
+		fwrite(&tick, sizeof(tick), 1, file);
+		fwrite(&offset, sizeof(offset), 1, file);
+	}
+	uint32_t count = (uint32_t) index.size();
+	fwrite(&count, sizeof(count), 1, file);
+	fwrite("PEDHMIDX", 1, 8, file);
+}
@@ -0,0 +1,82 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// HeatmapExporter writes heatmap frames to a compact on-disk
+// stream so that they can be analysed after the run. Frames are
+// handed over by the tick loop and encoded/written by a background
+// thread. At most maxQueuedFrames frames are kept in memory; when
+// the writer falls behind, new frames are dropped (and counted)
+// instead of stalling the simulation.
+//
+// File layout (little endian):
+//   header:  "PEDHM01\0" | uint32 width | uint32 height
+//   frame:   int64 tick | uint32 nbytes | nbytes of run-length
+//            encoded 8-bit cells, as (count, value) byte pairs
+//   index:   nframes x (int64 tick | uint64 file offset of frame)
+//            | uint32 nframes | "PEDHMIDX"
+//
+#ifndef _ped_heatmap_export_h_
+#define _ped_heatmap_export_h_
+
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace Ped {
+  class HeatmapExporter
+  {
+  public:
+    HeatmapExporter(const char *filename, int width, int height, int maxQueuedFrames = 8);
+
+    // Flushes all queued frames and writes the index
+    ~HeatmapExporter();
+
+    bool isOpen() const { return file != NULL; }
+
+    // Copies the grid (clamped to 8 bits) into the queue.
+    // Returns false if the frame had to be dropped.
+    bool pushFrame(long tick, int const * const * grid);
+
+    int getWrittenFrames() const { return writtenFrames; }
+    int getDroppedFrames() const { return droppedFrames; }
+
+  private:
+    struct Frame {
+      long tick;
+      std::vector<unsigned char> cells;
+    };
+
+    FILE *file;
+    int width;
+    int height;
+    int maxQueuedFrames;
+
+    // Read by the tick loop while the writer thread counts
+    std::atomic<int> writtenFrames;
+    std::atomic<int> droppedFrames;
+
+    // Frames waiting to be written, and recycled frame buffers
+    std::deque<Frame> queue;
+    std::vector<std::vector<unsigned char> > freeBuffers;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool stopping;
+    std::thread writer;
+
+    // (tick, offset) of every frame written so far
+    std::vector<std::pair<long, long> > index;
+
+    // Encoding scratch space, only used by the writer thread
+    std::vector<unsigned char> encoded;
+
+    void writerLoop();
+    void writeFrame(const Frame &frame);
+    void writeIndex();
+  };
+}
+
+#endif
@@ -0,0 +1,242 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Memory instrumentation: the footprint of a model by subsystem and,
+// with PED_ALLOC_STATS, the allocation counters of the tick phases
+// (see ped_profile.h).
+//
+#include "ped_model.h"
+#include "ped_profile.h"
+#include "ped_waypoint.h"
+#include "ped_scenario_image.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include <unistd.h>
+
+thread_local Ped::CurrentPhase Ped::currentPhase = { NULL, Ped::PHASE_COUNT };
+
+#ifdef PED_ALLOC_STATS
+
+// The global operator new of the whole process: libpedsim comes before
+// the C++ runtime in the lookup order of the program. Types with an
+// alignment above the default (alignas(64) slots and buffers) come in
+// through the std::align_val_t overloads.
+static void * countedAllocation(size_t size, size_t alignment = 0)
+{
+	Ped::CurrentPhase &current = Ped::currentPhase;
+	if (current.profile != NULL)
+	{
+		current.profile->addAllocation(current.phase, size);
+	}
+	void *memory = NULL;
+	if (alignment == 0)
+	{
+		memory = malloc(size > 0 ? size : 1);
+	}
+	else if (posix_memalign(&memory, std::max(alignment, sizeof(void*)), size > 0 ? size : 1) != 0)
+	{
+		memory = NULL;
+	}
+	if (memory == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void * operator new(size_t size)
+{
+	return countedAllocation(size);
+}
+
+void * operator new[](size_t size)
+{
+	return countedAllocation(size);
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return countedAllocation(size);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return NULL;
+	}
+}
+
+void * operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void * operator new(size_t size, std::align_val_t alignment)
+{
+	return countedAllocation(size, (size_t) alignment);
+}
+
+void * operator new[](size_t size, std::align_val_t alignment)
+{
+	return countedAllocation(size, (size_t) alignment);
+}
+
+void * operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return countedAllocation(size, (size_t) alignment);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return NULL;
+	}
+}
+
+void * operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+	return operator new(size, alignment, std::nothrow);
+}
+
+void operator delete(void *memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept
+{
+	free(memory);
+}
+
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept
+{
+	free(memory);
+}
+
+bool Ped::PhaseProfile::countsAllocations()
+{
+	return true;
+}
+
+#else
+
+bool Ped::PhaseProfile::countsAllocations()
+{
+	return false;
+}
+
+#endif
+
+Ped::MemoryFootprint Ped::Model::getMemoryFootprint() const
+{
+	MemoryFootprint footprint = {};
+	const size_t n = agents.size();
+
+	// The positions are in the image, the backend arrays or the agents
+	footprint.agents = agents.capacity() * sizeof(Tagent*) + n * sizeof(Tagent);
+	if (scenarioImage != NULL || xArray == NULL)
+	{
+		footprint.agents += 2 * n * sizeof(int);
+	}
+
+	footprint.routes = destinations.capacity() * sizeof(Twaypoint*) + destinations.size() * sizeof(Twaypoint);
+	for (const Tagent *agent : agents)
+	{
+		footprint.routes += agent->getRouteBytes();
+	}
+	if (scenarioImage != NULL)
+	{
+		const size_t routeLength = scenarioImage->getRouteStart()[n];
+		footprint.routes += (n + 1 + routeLength) * sizeof(uint32_t) + scenarioImage->getWaypointCount() * 3 * sizeof(double)
+			+ routeLength * sizeof(Twaypoint*);
+	}
+
+	footprint.spatialIndex = plane.capacity() * sizeof(std::vector<Tagent*>) + xBounds.capacity() * sizeof(xBounds[0])
+		+ boundaries2.capacity() * sizeof(std::vector<int>)
+		+ (size_t) boundaryRows * boundaryHeight * sizeof(std::atomic<bool>)
+		+ (sortKeys.capacity() + sortOrder.capacity()) * sizeof(uint32_t) + sortedAgents.capacity() * sizeof(Tagent*)
+		+ sortScratch.bytes();
+	for (const auto &region : plane)
+	{
+		footprint.spatialIndex += region.capacity() * sizeof(Tagent*);
+	}
+	for (const auto &boundary : boundaries2)
+	{
+		footprint.spatialIndex += boundary.capacity() * sizeof(int);
+	}
+
+	if (heatmap != NULL)
+	{
+		const size_t scaledSize = (size_t) heatmapSize * heatmapCellSize;
+		footprint.heatmap = (size_t) heatmapSize * heatmapSize * sizeof(int) + 2 * scaledSize * scaledSize * sizeof(int)
+			+ (heatmapSize + 2 * scaledSize) * sizeof(int*);
+	}
+
+	const size_t cells = (size_t) extentX * extentY;
+	if (occupancy != NULL)
+	{
+		footprint.fields += cells * sizeof(int);
+	}
+	if (densitySat != NULL)
+	{
+		footprint.fields += (size_t) (extentX + 1) * (extentY + 1) * sizeof(int);
+	}
+	if (crowdFields != NULL)
+	{
+		footprint.fields += cells * sizeof(CrowdCell);
+	}
+	if (clusterParent != NULL)
+	{
+		footprint.fields += cells * sizeof(std::atomic<int>);
+	}
+
+	// Sized as in setup()
+	if (xArray != NULL)
+	{
+		size_t arraySize = implementation == Ped::CUDA ? n + THREADS_PER_BLOCK - n % THREADS_PER_BLOCK : n + n % 4;
+		footprint.backend = arraySize * (3 * sizeof(int) + 3 * sizeof(float));
+	}
+
+	return footprint;
+}
+
+size_t Ped::Model::getResidentBytes()
+{
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (file == NULL)
+	{
+		return 0;
+	}
+	unsigned long size = 0, resident = 0;
+	int read = fscanf(file, "%lu %lu", &size, &resident);
+	fclose(file);
+	return read == 2 ? resident * (size_t) sysconf(_SC_PAGESIZE) : 0;
+}
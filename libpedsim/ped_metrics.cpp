@@ -0,0 +1,108 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Per-tick counters of what happened to the agents, and of how evenly
+// the work was spread over the threads. The backends count into one
+// slot per thread, on its own cache line, so counting never shares or
+// locks anything; the slots are summed once at the end of the tick
+// into a small ring of recent ticks.
+//
+#include "ped_model.h"
+
+#include <cstring>
+#include <algorithm>
+
+void Ped::Model::resetMetricsSlots(int threads)
+{
+	if ((int) metricsSlots.size() < threads)
+	{
+		metricsSlots.resize(threads);
+	}
+	metricsThreads = threads;
+	for (int t = 0; t < threads; t++)
+	{
+		memset(&metricsSlots[t].counts, 0, sizeof(TickMetrics));
+		memset(&metricsSlots[t].load, 0, sizeof(ThreadLoad));
+	}
+}
+
+void Ped::Model::countMoveOutcome(int thread, MOVE_OUTCOME outcome)
+{
+	// Moves outside of a tick (e.g. the micro-benchmarks) are not counted
+	if (thread >= metricsThreads)
+	{
+		return;
+	}
+	TickMetrics &counts = metricsSlot(thread);
+	switch (outcome)
+	{
+	case Ped::MOVED: counts.moved++; break;
+	case Ped::MOVED_ALTERNATIVE: counts.alternative++; break;
+	case Ped::BACKED_OFF: counts.backedOff++; break;
+	case Ped::BLOCKED: counts.blocked++; break;
+	}
+}
+
+void Ped::Model::reduceMetrics(uint64_t backendNanoseconds)
+{
+	// The single threaded backends are busy all the time
+	if (implementation != Ped::OMP && implementation != Ped::CTHREADS && metricsThreads == 1)
+	{
+		loadSlot(0).agents = agents.size();
+		loadSlot(0).busyNanoseconds = backendNanoseconds;
+	}
+
+	if (metricsHistory.size() != metricsHistorySize)
+	{
+		metricsHistory.assign(metricsHistorySize, TickMetrics());
+		metricsTicks = 0;
+	}
+
+	TickMetrics &total = metricsHistory[metricsTicks % metricsHistorySize];
+	memset(&total, 0, sizeof(total));
+	total.tick = tickCount;
+	for (int t = 0; t < metricsThreads; t++)
+	{
+		const TickMetrics &counts = metricsSlots[t].counts;
+		total.moved += counts.moved;
+		total.alternative += counts.alternative;
+		total.backedOff += counts.backedOff;
+		total.blocked += counts.blocked;
+		total.arrivals += counts.arrivals;
+		total.casFailures += counts.casFailures;
+	}
+
+	threadLoads.resize(metricsThreads);
+	uint64_t maxBusy = 0;
+	for (int t = 0; t < metricsThreads; t++)
+	{
+		ThreadLoad &load = threadLoads[t];
+		load = metricsSlots[t].load;
+		uint64_t accounted = load.busyNanoseconds + load.barrierNanoseconds;
+		load.idleNanoseconds = backendNanoseconds > accounted ? backendNanoseconds - accounted : 0;
+
+		total.busyNanoseconds += load.busyNanoseconds;
+		total.barrierNanoseconds += load.barrierNanoseconds;
+		total.idleNanoseconds += load.idleNanoseconds;
+		maxBusy = std::max(maxBusy, load.busyNanoseconds);
+	}
+	total.threads = metricsThreads;
+	total.imbalance = total.busyNanoseconds > 0 ? (double) maxBusy * metricsThreads / total.busyNanoseconds : 1.0;
+	metricsTicks++;
+}
+
+bool Ped::Model::getTickMetrics(size_t age, TickMetrics &metrics) const
+{
+	if (age >= metricsTicks || age >= metricsHistory.size())
+	{
+		return false;
+	}
+	metrics = metricsHistory[(metricsTicks - 1 - age) % metricsHistory.size()];
+	return true;
+}
+
+void Ped::Model::setMetricsHistory(size_t ticks)
+{
+	// Takes effect (and clears the history) with the next tick
+	metricsHistorySize = ticks > 0 ? ticks : 1;
+}
@@ -7,30 +7,36 @@
 //
 #include "ped_model.h"
 #include "ped_waypoint.h"
-#include "ped_model.h"
+#include "ped_heatmap_export.h"
+#include "ped_scenario_image.h"
+#include "ped_radix_sort.h"
+#include "ped_checkpoint.h"
+#include "ped_trajectory.h"
+#include "ped_position_stream.h"
+#include "ped_shared_state.h"
+#include "ped_profile.h"
+#include "ped_trace.h"
+#ifdef PED_WITH_CUDA
 #include "cuda_testkernel.h"
 #include "cuda_tick.h"
+#endif
 #include <iostream>
 #include <stack>
 #include <algorithm>
-#include <device_launch_parameters.h>
 #include <omp.h>
 #include <thread>
 #include <emmintrin.h>
 #include <smmintrin.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <unistd.h>
 #include <time.h>
 #include <atomic>
+#include <new>
+#include <chrono>
 using namespace std;
 
-struct less_than_key {
-  inline bool operator() (const Ped::Tagent* agent1, const Ped::Tagent* agent2) {
-    return (agent1->getX() < agent2->getX());
-  }
-};
-
 // Populate the vectors of regions with agents and the
 // plane vector with vectors of regions
 void Ped::Model::populate_regions(int x0, int x1, int x2, int x3, int x4) {
@@ -75,40 +81,104 @@ void Ped::Model::create_two_boundaries(int count, int xBound, int boundary_count
   // xBound contains last x
   
   int count2 = count - 1;
-  while (agents[count2]->getX() == xBound) {
-    atomic_store(&boundaries[boundary_counter][agents[count2]->getY()], 1);
+  while (count2 >= 0 && agents[count2]->getX() == xBound) {
+    markBoundary(boundary_counter, agents[count2]->getY());
     count2--;
   }
   boundary_counter++;
 
-  printf("size: %d, count: %d\n", agents.size(), count);
   if (count < agents.size()) {
     while(count < agents.size() && agents[count]->getX() == (xBound + 1)) {
-      printf("hello\n");
-      atomic_store(&boundaries[boundary_counter][agents[count]->getY()], 1);
+      markBoundary(boundary_counter, agents[count]->getY());
       count++;
     }
     boundary_counter++;
   }
-  printf("im out!\n");
+}
+
+// The boundary grid has two rows (left and right side) per region
+// border and one column per y coordinate of the scenario
+void Ped::Model::setupBoundaries(int rows) {
+	const int height = extentY + 2;
+	if (rows * height > boundaryRows * boundaryHeight) {
+		delete[] boundaries;
+		boundaries = new std::atomic<bool>[rows * height];
+	}
+	boundaryRows = rows;
+	boundaryHeight = height;
+	for (int i = 0; i < boundaryRows * boundaryHeight; i++) {
+		boundaries[i].store(false, std::memory_order_relaxed);
+	}
+}
+
+void Ped::Model::markBoundary(int row, int y) {
+	if (row < boundaryRows && y >= 0 && y < boundaryHeight) {
+		boundaries[row * boundaryHeight + y].store(true);
+	}
+}
+
+// Claims the boundary cell for this tick. Fails if another agent
+// already holds it; positions off the grid are never contested.
+bool Ped::Model::claimBoundary(int row, int y) {
+	if (row >= boundaryRows || y < 0 || y >= boundaryHeight) {
+		return true;
+	}
+	bool expected = false;
+	if (boundaries[row * boundaryHeight + y].compare_exchange_strong(expected, true)) {
+		return true;
+	}
+	int thread = omp_get_thread_num();
+	if (thread < metricsThreads) {
+		metricsSlot(thread).casFailures++;
+	}
+	return false;
+}
+
+void Ped::Model::sortAgentsByX() {
+	const size_t n = agents.size();
+	if (n == 0) {
+		return;
+	}
+
+	int minX = agents[0]->getX(), maxX = minX;
+	#pragma omp parallel for reduction(min:minX) reduction(max:maxX)
+	for (size_t i = 0; i < n; ++i) {
+		minX = std::min(minX, agents[i]->getX());
+		maxX = std::max(maxX, agents[i]->getX());
+	}
+
+	// Keys relative to the leftmost agent: usually one or two 8 bit passes
+	sortKeys.resize(n);
+	sortOrder.resize(n);
+	sortedAgents.resize(n);
+	#pragma omp parallel for
+	for (size_t i = 0; i < n; ++i) {
+		sortKeys[i] = (uint32_t) (agents[i]->getX() - minX);
+		sortOrder[i] = (uint32_t) i;
+	}
+
+	Ped::radixSortPairs(sortKeys.data(), sortOrder.data(), n, Ped::radixKeyBits((uint32_t) (maxX - minX)), &sortScratch);
+
+	#pragma omp parallel for
+	for (size_t i = 0; i < n; ++i) {
+		sortedAgents[i] = agents[sortOrder[i]];
+	}
+	agents.swap(sortedAgents);
 }
 
 void Ped::Model::populate_dynamic_regions() {
 	// Choose max percentage of agents allowed per region
-	float max_per_region = 0.20;
+	float max_per_region = regionFraction;
 		
 	// Determine the nr. of agents per region
 	float agents_per_region = std::floor(agents.size() * max_per_region);
-	std::cout << "Max per region: " << max_per_region << "\n"
-		  << "Agents per region: " << agents_per_region << "\n"
-		  << "Nr of agents: " << agents.size() << "\n";
 		
 	// Determine the nr. of regions
 	float nr_regions = std::ceil(agents.size() / agents_per_region);
-	std::cout << "Nr of regions: " << nr_regions << "\n";
+	setupBoundaries(2 * (int) nr_regions);
 		
 	// Sort the agent vector according to the agents' x coordinates
-	std::sort(agents.begin(), agents.end(), less_than_key());
+	sortAgentsByX();
 	int count = 0;
 	
 
@@ -119,7 +189,6 @@ void Ped::Model::populate_dynamic_regions() {
 
 	int boundary_counter = 0;
 	for (std::size_t i = 0; i < nr_regions; ++i) {
-	  printf("Region iteration: %d\n", i);
 	  std::vector<Ped::Tagent*> region;
 	  
 	  int xBound = 0;
@@ -130,7 +199,6 @@ void Ped::Model::populate_dynamic_regions() {
 	      count++;
 	    }
 	  }
-	  printf("size: %d, counT: %d\n", agents.size(), count);
 
 	  // REGION ------------------------
 
@@ -148,9 +216,7 @@ void Ped::Model::populate_dynamic_regions() {
 	    }
 	  }
 
-	  // DEBUG
 	  if (region.size() > 0) {
-	    cout << "Region size: " << region.size() << "\n";
 	    plane.push_back(region);
 	  }
 
@@ -159,40 +225,53 @@ void Ped::Model::populate_dynamic_regions() {
 	  // }
 
 	  // BOUNDARY ARRAYS --------------------
-	  printf("before create two boundaries\n");
 	  create_two_boundaries(count, xBound, boundary_counter);
 	  boundary_counter = boundary_counter + 2;
 	}
-
-	//DEBUG BEGIN
-	for (const auto x : xBounds) {
-	  printf("(%d, %d), ", get<0>(x), get<1>(x));
-	}
-	cout << "\n";
-	cout << "Plane size: " << plane.size() << "\n";
-	// DEBUG END
 }
 
 void Ped::Model::repopulate_dynamic_regions() {
   for (auto& region: plane) {
     region.clear();
   }
-  for (auto& boundary: boundaries) {
-    for (auto& element: boundary){
-      atomic_store(&element, 0);
-    }
-  }
   xBounds.clear();
   plane.clear();
   
   populate_dynamic_regions();
 }
 
-void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario, IMPLEMENTATION implementation, int number_of_threads)
+static const char * const IMPLEMENTATION_NAMES[] = { "CUDA", "VECTOR", "OMP", "PTHREAD", "CTHREADS", "SEQ", "SIMD", "AUTO" };
+
+const char * Ped::implementationName(IMPLEMENTATION implementation)
+{
+	return IMPLEMENTATION_NAMES[implementation];
+}
+
+bool Ped::parseImplementation(const char *name, IMPLEMENTATION &implementation)
 {
-	// Convenience test: does CUDA work on this machine?
-	cuda_test();
+	for (int i = 0; i < (int) (sizeof(IMPLEMENTATION_NAMES) / sizeof(IMPLEMENTATION_NAMES[0])); i++) {
+		if (strcmp(name, IMPLEMENTATION_NAMES[i]) == 0) {
+			implementation = (IMPLEMENTATION) i;
+			return true;
+		}
+	}
+	return false;
+}
 
+// Does CUDA work on this machine? Creating the context is slow, so
+// this is only checked (once) when a model asks for CUDA.
+bool Ped::cudaAvailable()
+{
+#ifdef PED_WITH_CUDA
+	static const bool available = cuda_test() == 0;
+	return available;
+#else
+	return false;
+#endif
+}
+
+void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario, IMPLEMENTATION implementation, int number_of_threads)
+{
 	// Set
 	agents = std::vector<Ped::Tagent*>(agentsInScenario.begin(), agentsInScenario.end());
 
@@ -201,12 +280,28 @@ void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<T
 
 	// Set the chosen implemenation. Standard in the given code is SEQ
 	this->implementation = implementation;
+	if (this->implementation == Ped::CUDA && !cudaAvailable()) {
+		std::cout << "Warning: CUDA is not available, using SEQ instead." << std::endl;
+		this->implementation = Ped::SEQ;
+	}
 
 	// Set number of threads to default value
 	this->number_of_threads = number_of_threads;
 
-	// Set up heatmap (relevant for Assignment 4)
-	setupHeatmapSeq();
+	// Replaces the implementation, threads and region size by the fastest
+	if (this->implementation == Ped::AUTO) {
+		autotune(agents, destinations);
+	}
+
+#ifdef PED_PROFILE
+	if (phaseProfile == NULL) {
+		phaseProfile = new Ped::PhaseProfile();
+	}
+#endif
+
+	// Size of the world, used to dimension the heatmap (relevant for Assignment 4).
+	// The heatmap itself is only allocated once someone calls enableHeatmap().
+	computeScenarioExtent();
 
 	// A comparator operator that enables the sorting of agents according
 	// to their x coordinates
@@ -298,73 +393,208 @@ void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<T
 	}
 }
 
-void thread_func(std::vector<Ped::Tagent*> agents, int start_idx, int end_idx) {
+void Ped::Model::setup(Ped::ScenarioImage *image, IMPLEMENTATION implementation, int number_of_threads)
+{
+	if (image == NULL) {
+		// Scenario could not be read (already reported), run an empty world
+		setup(std::vector<Ped::Tagent*>(), std::vector<Ped::Twaypoint*>(), implementation, number_of_threads);
+		return;
+	}
+	scenarioImage = image;
+
+	const size_t numAgents = image->getAgentCount();
+	const uint32_t *routeStart = image->getRouteStart();
+	const uint32_t *route = image->getRoute();
+
+	std::vector<Ped::Twaypoint*> destinationsInScenario;
+	for (size_t i = 0; i < image->getWaypointCount(); i++) {
+		destinationsInScenario.push_back(new Ped::Twaypoint(image->getWaypointX()[i], image->getWaypointY()[i], image->getWaypointR()[i]));
+	}
+
+	// One allocation for all agents, whose positions stay in the image,
+	// and one for all routes
+	agentBlock = (Ped::Tagent*) ::operator new(numAgents * sizeof(Ped::Tagent));
+	const size_t routeLength = routeStart[numAgents];
+	routeBlock = (Ped::Twaypoint**) malloc(std::max(routeLength, (size_t) 1) * sizeof(Ped::Twaypoint*));
+	std::vector<Ped::Tagent*> agentsInScenario(numAgents);
+
+	#pragma omp parallel for schedule(static)
+	for (size_t r = 0; r < routeLength; r++) {
+		routeBlock[r] = destinationsInScenario[route[r]];
+	}
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < numAgents; i++) {
+		Ped::Tagent *agent = new (&agentBlock[i]) Ped::Tagent(&image->getAgentX()[i], &image->getAgentY()[i]);
+		agent->setRoute(&routeBlock[routeStart[i]], routeStart[i + 1] - routeStart[i]);
+		agentsInScenario[i] = agent;
+	}
+
+	setup(agentsInScenario, destinationsInScenario, implementation, number_of_threads);
+}
+
+bool Ped::Model::writeSnapshot(const char *filename) const
+{
+	return Ped::ScenarioImage::write(filename, agents, destinations);
+}
+
+// Computes the bounding box of all agents and waypoints (including the
+// waypoint radius), so that grids over the world can be sized at runtime
+void Ped::Model::computeScenarioExtent() {
+	int maxX = 0;
+	int maxY = 0;
+	for (const auto& agent: agents) {
+		maxX = std::max(maxX, agent->getX());
+		maxY = std::max(maxY, agent->getY());
+	}
+	for (const auto& destination: destinations) {
+		maxX = std::max(maxX, (int) std::ceil(destination->getx() + destination->getr()));
+		maxY = std::max(maxY, (int) std::ceil(destination->gety() + destination->getr()));
+	}
+
+	// Leave room for the back off step in move()
+	extentX = maxX + 2;
+	extentY = maxY + 2;
+}
+
+// Nanoseconds from start until now
+static inline uint64_t nanosecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void thread_func(std::vector<Ped::Tagent*> agents, int start_idx, int end_idx, Ped::PhaseProfile *profile, int profileSlot,
+	Ped::TickMetrics *metrics, Ped::ThreadLoad *load, std::chrono::steady_clock::time_point *finished) {
+	// Only used by the timers of PED_PROFILE builds
+	(void) profile;
+	if (profileSlot >= 0) {
+		Ped::PhaseProfile::setThreadSlot(profileSlot);
+	}
+	PED_PROFILE_SCOPE(profile, Ped::PHASE_WORK);
+	auto start = std::chrono::steady_clock::now();
+
 	// The thread function
 	// Using a for loop with index
 
 	for(std::size_t i = start_idx; i < end_idx; ++i) {
+		agents[i]->clearArrived();
 		agents[i]->computeNextDesiredPosition();
+		metrics->arrivals += agents[i]->hasArrived();
 		agents[i]->setX(agents[i]->getDesiredX());
 		agents[i]->setY(agents[i]->getDesiredY());
 	}
+	metrics->moved += end_idx - start_idx;
+	load->agents = end_idx - start_idx;
+	load->busyNanoseconds = nanosecondsSince(start);
+	*finished = std::chrono::steady_clock::now();
 }
 
 void Ped::Model::tick()
 {
+	PED_PROFILE_SCOPE_ARG(phaseProfile, Ped::PHASE_TICK, tickCount);
+	auto backendStart = std::chrono::steady_clock::now();
+
 	// EDIT HERE FOR ASSIGNMENT 1
 	// 1. Retrieve each agent
 	// 2. Calculate its next desired position
 	// 3. Set its position to the calculated desired one
 	//
 	if (this->implementation == Ped::SEQ) {
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_SEQ);
+		resetMetricsSlots(1);
 
 		for (const auto& agent: agents) {
-			agent->computeNextDesiredPosition();
+			{
+				PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_DESIRED);
+				agent->clearArrived();
+				agent->computeNextDesiredPosition();
+				metricsSlot(0).arrivals += agent->hasArrived();
+			}
 			//agent->setX(agent->getDesiredX());
 			//agent->setY(agent->getDesiredY());
 			move(agent);
 		}
 	}
 	else if (this->implementation == Ped::CTHREADS) {
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_CTHREADS);
 		std::vector<std::thread> threads;
 		int chunk_size = agents.size() / this->number_of_threads;
+		resetMetricsSlots(this->number_of_threads);
+		std::vector<std::chrono::steady_clock::time_point> finished(this->number_of_threads);
+		while (phaseProfile != NULL && (int) workerProfileSlots.size() < this->number_of_threads) {
+			workerProfileSlots.push_back(Ped::PhaseProfile::newThreadSlot());
+		}
 
 		for (int i = 0; i < this->number_of_threads; i++) {
 
 			//Make sure not to miss any elements at the end of agent vector
 			int end_idx = std::min((i+1)*chunk_size, (int) agents.size());
 
-			threads.push_back(std::thread(thread_func, agents, i*chunk_size, end_idx));
+			int profileSlot = phaseProfile != NULL ? workerProfileSlots[i] : -1;
+			threads.push_back(std::thread(thread_func, agents, i*chunk_size, end_idx, phaseProfile, profileSlot, &metricsSlot(i), &loadSlot(i), &finished[i]));
 		}
 
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_BARRIER);
 		for (std::thread & t : threads) {
 			t.join();
 		}
+
+		// Each thread waited for the last one to finish
+		auto last = *std::max_element(finished.begin(), finished.end());
+		for (int i = 0; i < this->number_of_threads; i++) {
+			loadSlot(i).barrierNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(last - finished[i]).count();
+		}
 	}
 	else if (this->implementation == Ped::OMP) {
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_OMP);
 
-	  printf("before repop\n");
-	        repopulate_dynamic_regions();
-		printf("In tick(), after repopulate \n");
+		{
+			PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_REGIONS);
+			repopulate_dynamic_regions();
+		}
 		// Parallellize the outer loop only
 		omp_set_num_threads(plane.size());
-
-                #pragma omp parallel for
-		for (const auto& region: plane) {
-			for (const auto& agent: region) {
-				agent->computeNextDesiredPosition();
-				//agent->setX(agent->getDesiredX());
-				//agent->setY(agent->getDesiredY());
-				move_atomic(agent);
+		resetMetricsSlots(omp_get_max_threads());
+
+		#pragma omp parallel
+		{
+			Ped::TickMetrics &metrics = metricsSlot(omp_get_thread_num());
+			Ped::ThreadLoad &load = loadSlot(omp_get_thread_num());
+
+			#pragma omp for nowait
+			for (const auto& region: plane) {
+				PED_PROFILE_SCOPE_ARG(phaseProfile, Ped::PHASE_WORK, &region - &plane[0]);
+				auto regionStart = std::chrono::steady_clock::now();
+				for (const auto& agent: region) {
+					{
+						PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_DESIRED);
+						agent->clearArrived();
+						agent->computeNextDesiredPosition();
+						metrics.arrivals += agent->hasArrived();
+					}
+					//agent->setX(agent->getDesiredX());
+					//agent->setY(agent->getDesiredY());
+					move_atomic(agent);
+				}
+				load.agents += region.size();
+				load.busyNanoseconds += nanosecondsSince(regionStart);
 			}
-		}
 
-		printf("forloop over\n");
+			// The wait for the slowest region
+			PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_BARRIER);
+			auto waitStart = std::chrono::steady_clock::now();
+			#pragma omp barrier
+			load.barrierNanoseconds = nanosecondsSince(waitStart);
+		}
 	}
 	else if(this->implementation == Ped::SIMD) {
+		PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_SIMD);
 		__m128 t0, t1, t2, t3, t4, t5, t6, t7, reached, diffX, diffY;
 		__m128i xint, yint;
 		__m128 xfloat, yfloat;
+		resetMetricsSlots(1);
+		Ped::TickMetrics &metrics = metricsSlot(0);
+		metrics.moved = agents.size();
 
 		for (int i = 0; i < agents.size(); i+=4) {
 
@@ -406,6 +636,7 @@ void Ped::Model::tick()
 				int c = mask & 1;
 
 				if (c == 1 && (i+j) < agents.size()) {
+					metrics.arrivals++;
 					Ped::Twaypoint* nextDest = agents[i+j]->getNextDestinationSpecial();
 					destXarray[i+j] = (float) nextDest->getx();
 					destYarray[i+j] = (float) nextDest->gety();
@@ -416,11 +647,16 @@ void Ped::Model::tick()
 			}
 		}
 	}
+#ifdef PED_WITH_CUDA
 	else if (this->implementation == Ped::CUDA) {
+	  PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_CUDA);
 	  tickCuda(xArray, yArray, destXarray, destYarray, destRarray, destReached, NUM_BLOCKS, THREADS_PER_BLOCK);
+	  resetMetricsSlots(1);
+	  metricsSlot(0).moved = agents.size();
 
 	  for (int i = 0; i < agents.size(); i++) {
 	    if (destReached[i]) {
+	      metricsSlot(0).arrivals++;
 	      Ped::Twaypoint* nextDest = agents[i]->getNextDestinationSpecial();
 	      destXarray[i] = (float) nextDest->getx();
 	      destYarray[i] = (float) nextDest->gety();
@@ -429,6 +665,29 @@ void Ped::Model::tick()
 	    }
 	  }
 	}
+#endif
+
+	tickCount++;
+	reduceMetrics(nanosecondsSince(backendStart));
+
+	// Heatmap and analytics are only maintained when someone asked for them
+	updateAgentFields();
+
+	PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_OUTPUTS);
+	saveCheckpointIfDue();
+
+	if (trajectoryRecorder != NULL && tickCount % trajectoryEvery == 0) {
+		trajectoryRecorder->record(tickCount);
+	}
+	if (positionStreamer != NULL) {
+		positionStreamer->pushFrame(tickCount);
+	}
+	if (stateHashing) {
+		recordStateHash();
+	}
+	if (sharedState != NULL) {
+		sharedState->publish(tickCount, heatmap != NULL ? heatmap[0] : NULL);
+	}
 }
 
 ////////////
@@ -439,6 +698,7 @@ void Ped::Model::tick()
 // The same function as move below, only that this one does things atomically, using CAS
 void Ped::Model::move_atomic(Ped::Tagent *agent)
 {
+  PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_MOVE);
   int tid = omp_get_thread_num();
 	// Search for neighboring agents
 	set<const Ped::Tagent *> neighbors = getNeighbors(agent->getX(), agent->getY(), 2);
@@ -485,16 +745,14 @@ void Ped::Model::move_atomic(Ped::Tagent *agent)
 		  
 		  // CAS
 		  bool check = false;
-		  bool test = false;
-		  bool newval = true;
 		  for (int i = 0; i < xBounds.size(); i++) {
 		    // even index
 		    if ((*it).first == get<0>(xBounds[i])) {
-		      check = boundaries[i*2][(*it).second].compare_exchange_weak(test, newval);
+		      check = claimBoundary(i*2, (*it).second);
 		    }
 		    // odd index
 		    else if ((*it).first == get<1>(xBounds[i])) {
-		      check = boundaries[i*2+1][(*it).second].compare_exchange_weak(test, newval);
+		      check = claimBoundary(i*2+1, (*it).second);
 		    }
 		    else {
 		      check = true;
@@ -505,6 +763,7 @@ void Ped::Model::move_atomic(Ped::Tagent *agent)
 		    // Set the agent's position
 		    agent->setX((*it).first);
 		    agent->setY((*it).second);
+		    agent->setMoveOutcome(it == prioritizedAlternatives.begin() ? Ped::MOVED : Ped::MOVED_ALTERNATIVE);
 		    changed_pos = true;
 		    break;
 		  }
@@ -520,16 +779,14 @@ void Ped::Model::move_atomic(Ped::Tagent *agent)
 		if (std::find(takenPositions.begin(), takenPositions.end(), back_off) == takenPositions.end()) {
 		  // CAS
 		  bool check = false;
-		  bool test = false;
-		  bool newval = true;
 		  for (int i = 0; i < xBounds.size(); i++) {
 		    // even index
 		    if (back_off.first == get<0>(xBounds[i])) {
-		      check = boundaries[i*2][back_off.second].compare_exchange_weak(test, newval);
+		      check = claimBoundary(i*2, back_off.second);
 		    }
 		    // odd index
 		    else if (back_off.first == get<1>(xBounds[i])) {
-		      check = boundaries[i*2+1][back_off.second].compare_exchange_weak(test, newval);
+		      check = claimBoundary(i*2+1, back_off.second);
 		    }
 		    else {
 		      check = true;
@@ -538,6 +795,7 @@ void Ped::Model::move_atomic(Ped::Tagent *agent)
 		  if (check) {
 			agent->setX(back_off.first);
 			agent->setY(back_off.second);
+			agent->setMoveOutcome(Ped::BACKED_OFF);
 			changed_pos = true;
 		  }
 		}
@@ -547,16 +805,14 @@ void Ped::Model::move_atomic(Ped::Tagent *agent)
 		if (std::find(takenPositions.begin(), takenPositions.end(), back_off) == takenPositions.end()) {
 		  // CAS
 		  bool check = false;
-		  bool test = false;
-		  bool newval = true;
 		  for (int i = 0; i < xBounds.size(); i++) {
 		    // even index
 		    if (back_off.first == get<0>(xBounds[i])) {
-		      check = boundaries[i*2][back_off.second].compare_exchange_weak(test, newval);
+		      check = claimBoundary(i*2, back_off.second);
 		    }
 		    // odd index
 		    else if (back_off.first == get<1>(xBounds[i])) {
-		      check = boundaries[i*2+1][back_off.second].compare_exchange_weak(test, newval);
+		      check = claimBoundary(i*2+1, back_off.second);
 		    }
 		    else {
 		      check = true;
@@ -565,15 +821,22 @@ void Ped::Model::move_atomic(Ped::Tagent *agent)
 		  if (check) {
 			agent->setX(back_off.first);
 			agent->setY(back_off.second);
+			agent->setMoveOutcome(Ped::BACKED_OFF);
 			changed_pos = true;
 		  }
 		}
 	}
+	if (changed_pos == false) {
+		agent->setMoveOutcome(Ped::BLOCKED);
+	}
+	countMoveOutcome(tid, agent->getMoveOutcome());
 }
 // Moves the agent to the next desired position. If already taken, it will
 // be moved to a location close to it.
 void Ped::Model::move(Ped::Tagent *agent)
 {
+	PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_MOVE);
+
 	// Search for neighboring agents
 	set<const Ped::Tagent *> neighbors = getNeighbors(agent->getX(), agent->getY(), 2);
 
@@ -619,6 +882,7 @@ void Ped::Model::move(Ped::Tagent *agent)
 			// Set the agent's position
 			agent->setX((*it).first);
 			agent->setY((*it).second);
+			agent->setMoveOutcome(it == prioritizedAlternatives.begin() ? Ped::MOVED : Ped::MOVED_ALTERNATIVE);
 			changed_pos = true;
 			break;
 		}
@@ -631,6 +895,7 @@ void Ped::Model::move(Ped::Tagent *agent)
 		if (std::find(takenPositions.begin(), takenPositions.end(), back_off) == takenPositions.end()) {
 			agent->setX(back_off.first);
 			agent->setY(back_off.second);
+			agent->setMoveOutcome(Ped::BACKED_OFF);
 			changed_pos = true;
 		}
 	}
@@ -639,9 +904,15 @@ void Ped::Model::move(Ped::Tagent *agent)
 		if (std::find(takenPositions.begin(), takenPositions.end(), back_off) == takenPositions.end()) {
 			agent->setX(back_off.first);
 			agent->setY(back_off.second);
+			agent->setMoveOutcome(Ped::BACKED_OFF);
 			changed_pos = true;
-		}
+		}
+
+	}
+	if (changed_pos == false) {
+		agent->setMoveOutcome(Ped::BLOCKED);
 	}
+	countMoveOutcome(0, agent->getMoveOutcome());
 }
 
 /// Returns the list of neighbors within dist of the point x/y. This
@@ -653,6 +924,8 @@ void Ped::Model::move(Ped::Tagent *agent)
 /// \param   dist the distance around x/y that will be searched for agents (search field is a square in the current implementation)
 set<const Ped::Tagent*> Ped::Model::getNeighbors(int x, int y, int dist) const {
 
+	PED_PROFILE_SCOPE(phaseProfile, Ped::PHASE_NEIGHBORS);
+
 	//return set<const Ped::Tagent*>(agents.begin(), agents.end());
 	set<const Ped::Tagent*> closeby_agents = {};
 
@@ -673,6 +946,38 @@ void Ped::Model::cleanup() {
 
 Ped::Model::~Model()
 {
-	std::for_each(agents.begin(), agents.end(), [](Ped::Tagent *agent){delete agent;});
+	// Flushes the remaining frames before the heatmap goes away
+	delete heatmapExporter;
+	// Finishes the checkpoint being written, if any
+	delete checkpointWriter;
+	delete trajectoryRecorder;
+	delete positionStreamer;
+	delete sharedState;
+	if (traceRecorder != NULL) {
+		if (!writeTrace(traceFile.c_str())) {
+			std::cerr << "Warning: could not write trace " << traceFile << "." << std::endl;
+		}
+		phaseProfile->setTrace(NULL);
+		delete traceRecorder;
+	}
+	delete phaseProfile;
+	if (stateHashLog != NULL) {
+		fclose(stateHashLog);
+	}
+	freeHeatmapSeq();
+	delete[] clusterParent;
+	delete[] boundaries;
+	free(crowdFields);
+	free(occupancy);
+	free(densitySat);
+	if (agentBlock != NULL) {
+		std::for_each(agents.begin(), agents.end(), [](Ped::Tagent *agent){agent->~Tagent();});
+		::operator delete(agentBlock);
+		free(routeBlock);
+		delete scenarioImage;
+	}
+	else {
+		std::for_each(agents.begin(), agents.end(), [](Ped::Tagent *agent){delete agent;});
+	}
 	std::for_each(destinations.begin(), destinations.end(), [](Ped::Twaypoint *destination){delete destination; });
 }
@@ -14,17 +14,129 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <string>
+#include <cstdio>
 
 #include "ped_agent.h"
+#include "ped_radix_sort.h"
 #include <atomic>
+#include <array>
+#include <cstdint>
 
 // Thread function
 namespace Ped{
   class Tagent;
+  class HeatmapExporter;
+  class ScenarioImage;
+  class CheckpointWriter;
+  class TrajectoryRecorder;
+  class PositionStreamer;
+  class SharedStateWriter;
+  class PhaseProfile;
+  class TraceRecorder;
+  struct CheckpointState;
 
   // The implementation modes for Assignment 1 + 2:
-  // chooses which implementation to use for tick()
-  enum IMPLEMENTATION { CUDA, VECTOR, OMP, PTHREAD, CTHREADS, SEQ, SIMD };
+  // chooses which implementation to use for tick(). AUTO picks SEQ or
+  // OMP in setup() (see ped_autotune.cpp).
+  enum IMPLEMENTATION { CUDA, VECTOR, OMP, PTHREAD, CTHREADS, SEQ, SIMD, AUTO };
+
+  // The name of an implementation ("SEQ", "OMP", ...), and the
+  // implementation of a name (false if there is none)
+  const char * implementationName(IMPLEMENTATION implementation);
+  bool parseImplementation(const char *name, IMPLEMENTATION &implementation);
+
+  // Whether the CUDA backend can run on this machine
+  bool cudaAvailable();
+
+  // Crowd analytics of one grid cell during the last tick
+  struct CrowdCell {
+    // Agents standing in the cell
+    int agents;
+    // Agents that wanted to move into the cell
+    int desired;
+    // Agents in the cell that backed off or could not move at all
+    int blocked;
+    // Agents in the cell that reached a waypoint
+    int arrivals;
+    // Summed displacement of the agents in the cell
+    float sumVx;
+    float sumVy;
+
+    float meanVx() const { return agents > 0 ? sumVx / agents : 0.0f; }
+    float meanVy() const { return agents > 0 ? sumVy / agents : 0.0f; }
+  };
+
+  // What happened to the agents in one tick (see ped_metrics.cpp)
+  struct TickMetrics {
+    // The tick (getTickCount() after it)
+    long tick;
+    // Agents that moved to their desired position, to one of the
+    // alternatives, backed off or could not move at all. CTHREADS,
+    // SIMD and CUDA move every agent to its desired position.
+    uint64_t moved;
+    uint64_t alternative;
+    uint64_t backedOff;
+    uint64_t blocked;
+    // Agents that reached a waypoint
+    uint64_t arrivals;
+    // Boundary cells move_atomic could not claim (OMP)
+    uint64_t casFailures;
+    // Threads of the backend, their summed busy, barrier wait and idle
+    // time (see ThreadLoad), and the busy time of the busiest thread
+    // over the mean busy time (1: perfectly balanced)
+    int threads;
+    uint64_t busyNanoseconds;
+    uint64_t barrierNanoseconds;
+    uint64_t idleNanoseconds;
+    double imbalance;
+  };
+
+  // One thread's share of the backend in a tick. Busy is the time spent
+  // moving agents (OMP regions, a CTHREADS chunk), barrier the time
+  // then spent waiting for the other threads, and idle the rest of the
+  // backend's time: thread start up and serial parts such as building
+  // the OMP regions. SEQ, SIMD and CUDA have one thread that is always busy.
+  struct ThreadLoad {
+    uint64_t agents;
+    uint64_t busyNanoseconds;
+    uint64_t barrierNanoseconds;
+    uint64_t idleNanoseconds;
+  };
+
+  // A jam: connected (8-neighbourhood) cells that contain blocked agents
+  struct CongestionCluster {
+    // Number of blocked agents in the cluster
+    int agents;
+    // Number of cells in the cluster
+    int cells;
+    // Bounding box, both corners inclusive
+    int x0, y0, x1, y1;
+  };
+
+  // Rectangle of grid cells, both corners inclusive
+  struct Rect {
+    int x0, y0, x1, y1;
+  };
+
+  // Bytes held by the parts of a model (estimated from the sizes of its
+  // buffers and containers, see ped_memory.cpp)
+  struct MemoryFootprint {
+    // Agent objects and their positions
+    size_t agents;
+    // Waypoints and the agents' routes
+    size_t routes;
+    // OMP regions, boundary grid and sort scratch space
+    size_t spatialIndex;
+    // Raw, scaled and blurred heatmap
+    size_t heatmap;
+    // Occupancy, density, crowd fields and congestion grids
+    size_t fields;
+    // SIMD and CUDA position and destination arrays
+    size_t backend;
+
+    size_t total() const { return agents + routes + spatialIndex + heatmap + fields + backend; }
+  };
 
   class Model
   {
@@ -39,10 +151,31 @@ namespace Ped{
     // ------------------------------------------------------------------
     // Sets everything up
     void setup(std::vector<Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario,IMPLEMENTATION implementation, int number_of_threads = 2);		
+
+    // Sets everything up from a (mapped) scenario image. The agents use the
+    // image's position columns directly and are created in one block.
+    // The model takes ownership of the image.
+    void setup(ScenarioImage *image, IMPLEMENTATION implementation, int number_of_threads = 2);
+
+    // Writes the current positions and remaining routes as a scenario image
+    bool writeSnapshot(const char *filename) const;
 	
     // Coordinates a time step in the scenario: move all agents by one step (if applicable).
     void tick();
 
+    // The implementation and number of threads in use (what AUTO chose)
+    IMPLEMENTATION getImplementation() const { return implementation; }
+    int getNumberOfThreads() const { return number_of_threads; }
+
+    // Share of the agents in each OMP region. Set before setup(); AUTO
+    // chooses it along with the implementation.
+    void setRegionFraction(float fraction) { regionFraction = fraction; }
+    float getRegionFraction() const { return regionFraction; }
+
+    // File in which AUTO keeps its choice per host and scenario (NULL
+    // or "" to run the trials every time)
+    void setAutotuneCache(const char *filename) { autotuneCache = filename != NULL ? filename : ""; }
+
     // Returns the agents of this scenario
     const std::vector<Tagent*> getAgents() const { return agents; };
 
@@ -53,11 +186,131 @@ namespace Ped{
     void cleanup();
     ~Model();
 
+    // Allocates the heatmap buffers and turns on the per-tick heatmap update.
+    // Nothing is allocated until this is called. A size of 0 picks the grid
+    // size from the scenario extent; cellSize is the upscale factor for the
+    // view and decay the fraction of heat that survives a tick. False if
+    // the size would change while the heatmap is exported.
+    bool enableHeatmap(int size = 0, int cellSize = 5, float decay = 0.80f);
+    bool isHeatmapEnabled() const { return heatmap != NULL; }
+
     // Returns the heatmap visualizing the density of agents
-    int const * const * getHeatmap() const { return blurred_heatmap; };
+    // (NULL until enableHeatmap() has been called). It is scaled and
+    // blurred on the first call after a tick, not by the tick itself.
+    int const * const * getHeatmap() const;
     int getHeatmapSize() const;
 
+    // Writes every Nth heatmap frame to filename in the background
+    // (see ped_heatmap_export.h). Enables the heatmap if necessary.
+    void enableHeatmapExport(const char *filename, int everyNthTick = 1);
+
+    // Keeps a summed-area table of agent occupancy that is refreshed
+    // once per tick, so that rectangle counts are O(1)
+    void enableDensityQueries();
+
+    // Number of agents in [x0,x1] x [y0,y1] after the last tick
+    int countInRect(int x0, int y0, int x1, int y1) const;
+
+    // Same as countInRect for many rectangles at once
+    void countInRects(const std::vector<Rect> &rects, std::vector<int> &counts) const;
+
+    // Maintains per-cell crowd analytics (see CrowdCell), refreshed once per tick
+    void enableCrowdFields();
+
+    // The crowd analytics of the last tick, getExtentX() x getExtentY()
+    // cells in row-major order (NULL until enableCrowdFields() has been called)
+    const CrowdCell * getCrowdFields() const { return crowdFields; }
+
+    // Detects jams every tick: clusters of adjacent cells with blocked
+    // agents holding at least minAgents blocked agents. Enables the crowd fields.
+    void enableCongestionDetection(int minAgents = 2);
+
+    // The jams found in the last tick
+    const std::vector<CongestionCluster> & getCongestionClusters() const { return congestionClusters; }
+
+    // Number of ticks simulated so far
+    long getTickCount() const { return tickCount; }
+
+    // The metrics of a recent tick: age 0 is the last tick. False if
+    // that tick is not (or no longer) in the history.
+    bool getTickMetrics(size_t age, TickMetrics &metrics) const;
+
+    // Number of ticks kept in the metrics history (default 128)
+    void setMetricsHistory(size_t ticks);
+
+    // The load of every thread of the backend in the last tick
+    const std::vector<ThreadLoad> & getThreadLoads() const { return threadLoads; }
+
+    // Hashes the positions and destinations of all agents after every
+    // tick from now on (see ped_state_hash.cpp), and logs "tick hash"
+    // lines to logFile if given. Two backends simulate the same crowd
+    // as long as their hashes agree. Only the hashes of the last
+    // historyTicks ticks are kept in memory; the log has all of them.
+    bool enableStateHash(const char *logFile = NULL, size_t historyTicks = 1024);
+
+    // The hash after a tick; false if that tick was not hashed (or is
+    // no longer kept)
+    bool getStateHash(long tick, uint64_t &hash) const;
+
+    // The hash of the current state
+    uint64_t computeStateHash() const;
+
+    // Writes a checkpoint (see ped_checkpoint.h) to filename every Nth
+    // tick. The state is copied at the end of the tick and written in
+    // the background; checkpoints due while one is still being written
+    // are skipped.
+    void enableCheckpoints(const char *filename, int everyNthTick);
+
+    // Writes a checkpoint of the current state right away
+    bool writeCheckpoint(const char *filename) const;
+
+    // Resumes from a checkpoint written by a model set up from the same
+    // scenario. Derived data (density, crowd fields, the scaled
+    // heatmap) is refreshed by the next tick.
+    bool restoreCheckpoint(const char *filename);
+
+    // Records the positions of every agentStride-th agent every Nth
+    // tick (and once right away) to filename, see ped_trajectory.h
+    void enableTrajectoryRecording(const char *filename, int everyNthTick = 1, int agentStride = 1);
+
+    // Streams the positions of every tick, delta encoded, to a named
+    // pipe or "unix:<socket path>", see ped_position_stream.h
+    void enablePositionStream(const char *target, int keyframeEvery = 100);
+
+    // Publishes the positions (and the raw heatmap, if enabled) of every
+    // tick in the POSIX shared memory segment name, for readers in other
+    // processes, see ped_shared_state.h. Enabling the heatmap later, or
+    // changing its size, replaces the segment.
+    void enableSharedState(const char *name);
+
+    // Time spent in the phases of tick(), see ped_profile.h (NULL
+    // unless libpedsim was built with PED_PROFILE)
+    const PhaseProfile * getPhaseProfile() const;
+    void resetPhaseProfile();
+
+    // Also counts cycles, instructions, cache and branch misses per
+    // phase and thread. False without PED_PROFILE or perf counters.
+    bool enableHardwareCounters();
+
+    // Records a per-thread timeline of the tick phases and writes it
+    // to filename (Chrome trace format, see ped_trace.h) when the
+    // model is destroyed. Needs PED_PROFILE.
+    void enableTrace(const char *filename, size_t eventsPerThread = 1 << 18);
+    bool writeTrace(const char *filename) const;
+
+    // Memory used by this model, by subsystem
+    MemoryFootprint getMemoryFootprint() const;
+
+    // Resident memory of the whole process (0 if unknown)
+    static size_t getResidentBytes();
+
+    // Extent of the scenario (agents and waypoints), computed in setup
+    int getExtentX() const { return extentX; }
+    int getExtentY() const { return extentY; }
+
   private:
+    // Times the private kernels on synthetic scenarios (microbench/)
+    friend class KernelBench;
 
     // Denotes which implementation (sequential, parallel implementations..)
     // should be used for calculating the desired positions of
@@ -67,15 +320,60 @@ namespace Ped{
     // Denotes the number of threads to use in PTHREADS modes
     int number_of_threads;
 
+    // Share of the agents in each OMP region
+    float regionFraction = 0.20f;
+
+    std::string autotuneCache = "pedsim-autotune.cache";
+
+    // Times SEQ and OMP on a copy of the scenario and sets up the
+    // fastest (AUTO)
+    void autotune(const std::vector<Tagent*> &agentsInScenario, const std::vector<Twaypoint*> &destinationsInScenario);
+
+    // Ticks simulated so far
+    long tickCount = 0;
+
+    // The metrics of the running tick, one slot per thread of the
+    // backend, each on its own cache line
+    struct alignas(64) MetricsSlot {
+      TickMetrics counts;
+      ThreadLoad load;
+    };
+    std::vector<MetricsSlot> metricsSlots;
+    int metricsThreads = 0;
+    std::vector<ThreadLoad> threadLoads;
+
+    // Ring of the hashes of the last ticks; hashedTicks ticks were
+    // hashed since enableStateHash(), starting with firstHashedTick
+    bool stateHashing = false;
+    std::vector<uint64_t> stateHashes;
+    size_t hashedTicks = 0;
+    long firstHashedTick = 0;
+    FILE *stateHashLog = NULL;
+    void recordStateHash();
+
+    // Ring of the metrics of the last ticks
+    std::vector<TickMetrics> metricsHistory;
+    size_t metricsHistorySize = 128;
+    size_t metricsTicks = 0;
+
+    // Clears the slots of threads 0 .. threads-1 (before the backend)
+    void resetMetricsSlots(int threads);
+    TickMetrics & metricsSlot(int thread) { return metricsSlots[thread].counts; }
+    void countMoveOutcome(int thread, MOVE_OUTCOME outcome);
+    ThreadLoad & loadSlot(int thread) { return metricsSlots[thread].load; }
+    // Sums the slots into the history (after the backend, which took
+    // backendNanoseconds)
+    void reduceMetrics(uint64_t backendNanoseconds);
+
     // Arrays
-    int *xArray;
-    int *yArray;
+    int *xArray = NULL;
+    int *yArray = NULL;
     
-    float *destXarray;
-    float *destYarray;
-    float *destRarray;
+    float *destXarray = NULL;
+    float *destYarray = NULL;
+    float *destRarray = NULL;
     
-    int *destReached;
+    int *destReached = NULL;
 
     // Determine the region coordinates (4 regions)
     // I am basing this on the max coordinates I have seen in the 
@@ -86,11 +384,23 @@ namespace Ped{
     int x3;
     int x4;	
 
+    // Bounding box of agents and waypoints, [0, extentX) x [0, extentY)
+    int extentX = 0;
+    int extentY = 0;
+    void computeScenarioExtent();
+
     // The agents in this scenario
     std::vector<Tagent*> agents;
 
     // The waypoints in this scenario
     std::vector<Twaypoint*> destinations;
+
+    // Set when the scenario came from an image: the agents then live in
+    // one block, their positions in the image and their routes in one
+    // array of waypoints
+    ScenarioImage *scenarioImage = NULL;
+    Tagent *agentBlock = NULL;
+    Twaypoint **routeBlock = NULL;
 		
     // Moves an agent towards its next position
     void move(Ped::Tagent *agent);
@@ -102,7 +412,23 @@ namespace Ped{
     std::vector<std::vector<Ped::Tagent*>> plane;
     std::vector<std::tuple<int, int>> xBounds;
     std::vector<std::vector<int>> boundaries2;
-    std::array<std::array<std::atomic<bool>, 150>, 10> boundaries;
+
+    // Boundary cells claimed by agents this tick, boundaryRows x boundaryHeight
+    std::atomic<bool> *boundaries = NULL;
+    int boundaryRows = 0;
+    int boundaryHeight = 0;
+    void setupBoundaries(int rows);
+    void markBoundary(int row, int y);
+    bool claimBoundary(int row, int y);
+
+    // Scratch space of sortAgentsByX, kept between ticks
+    std::vector<uint32_t> sortKeys;
+    std::vector<uint32_t> sortOrder;
+    std::vector<Ped::Tagent*> sortedAgents;
+    RadixSortScratch sortScratch;
+
+    // Reorders agents by x coordinate (stable, parallel radix sort)
+    void sortAgentsByX();
 
     //--------------- CUDA -----------------
     int NUM_BLOCKS;
@@ -122,21 +448,81 @@ namespace Ped{
     /// Everything below here won't be relevant until Assignment 4
     ///////////////////////////////////////////////
 
-#define SIZE 1024
-#define CELLSIZE 5
-#define SCALED_SIZE SIZE*CELLSIZE
+    // Heatmap resolution, set at runtime (see enableHeatmap)
+    int heatmapSize = 0;
+    int heatmapCellSize = 5;
+    float heatmapDecay = 0.80f;
 
     // The heatmap representing the density of agents
-    int ** heatmap;
+    int ** heatmap = NULL;
 
     // The scaled heatmap that fits to the view
-    int ** scaled_heatmap;
+    int ** scaled_heatmap = NULL;
 
     // The final heatmap: blurred and scaled to fit the view
-    int ** blurred_heatmap;
+    int ** blurred_heatmap = NULL;
+
+    // The tick the view image was last rendered for
+    mutable long heatmapRenderedTick = -1;
+
+    // Heatmap frame export (optional)
+    HeatmapExporter *heatmapExporter = NULL;
+    int heatmapExportEvery = 1;
+
+    // Periodic checkpoints (optional)
+    CheckpointWriter *checkpointWriter = NULL;
+    int checkpointEvery = 1;
+    void saveCheckpointIfDue();
+    void captureCheckpoint(CheckpointState &state) const;
+
+    // Trajectory recording (optional)
+    TrajectoryRecorder *trajectoryRecorder = NULL;
+    int trajectoryEvery = 1;
+
+    // Live position stream (optional)
+    PositionStreamer *positionStreamer = NULL;
+
+    // Shared memory state export (optional)
+    SharedStateWriter *sharedState = NULL;
+
+    // Phase timers and timeline (PED_PROFILE builds only)
+    PhaseProfile *phaseProfile = NULL;
+    TraceRecorder *traceRecorder = NULL;
+    std::string traceFile;
+    // The profile slot of each CTHREADS worker, which the worker's new
+    // thread takes over every tick
+    std::vector<int> workerProfileSlots;
+
+    // Per-cell crowd analytics (optional)
+    CrowdCell *crowdFields = NULL;
+
+    // Union-find forest over the grid for the jam detection
+    // (-1 for cells without blocked agents)
+    std::atomic<int> *clusterParent = NULL;
+    int minClusterAgents = 2;
+    std::vector<CongestionCluster> congestionClusters;
+    void detectCongestion();
+
+    // One fused pass over the agents that feeds the heatmap, the
+    // occupancy grid and the crowd fields, followed by their updates
+    void updateAgentFields();
+    void accumulateAgentFields();
+
+    // Agent count per cell and its summed-area table, which has one
+    // extra leading row and column of zeros (density queries)
+    int *occupancy = NULL;
+    int *densitySat = NULL;
+    void updateDensitySat();
 
     void setupHeatmapSeq();
-    void updateHeatmapSeq();
+    void freeHeatmapSeq();
+
+    // Heatmap stages: decay and clamp are run by updateAgentFields()
+    // around the scatter, scale and blur by getHeatmap()
+    void decayHeatmapSeq();
+    void clampHeatmapSeq();
+    void scaleHeatmapSeq() const;
+    void blurHeatmapSeq() const;
   };
 }
 #endif
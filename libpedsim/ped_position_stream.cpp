@@ -0,0 +1,375 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Delta-encoded live position stream, see ped_position_stream.h
+//
+#include "ped_position_stream.h"
+#include "ped_model.h"
+
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CODE_SAME 0
+#define CODE_PLUS 1
+#define CODE_MINUS 2
+#define CODE_ESCAPE 3
+
+// Bounds of the delay between failed attempts to connect
+#define CONNECT_DELAY_MIN std::chrono::milliseconds(10)
+#define CONNECT_DELAY_MAX std::chrono::milliseconds(1000)
+
+Ped::PositionStreamer::PositionStreamer(const char *target, const std::vector<Tagent*> &agents,
+	int keyframeEvery, int maxQueuedFrames) :
+	target(target), positions(agents), keyframeEvery(keyframeEvery > 0 ? keyframeEvery : 1),
+	maxQueuedFrames(maxQueuedFrames), sentFrames(0), droppedFrames(0), stopping(false),
+	fd(-1), nextConnect(std::chrono::steady_clock::now()), connectDelay(CONNECT_DELAY_MIN), framesSinceKeyframe(0)
+{
+	// Worst case: a keyframe
+	encoded.resize(2 * positions.size() * sizeof(int32_t));
+	writer = std::thread(&Ped::PositionStreamer::writerLoop, this);
+}
+
+Ped::PositionStreamer::~PositionStreamer()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_one();
+	writer.join();
+	disconnect();
+
+	if (droppedFrames > 0)
+	{
+		std::cout << "Note: position stream dropped " << droppedFrames << " frames." << std::endl;
+	}
+}
+
+bool Ped::PositionStreamer::pushFrame(long tick)
+{
+	Frame frame;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if ((int) queue.size() >= maxQueuedFrames)
+		{
+			droppedFrames++;
+			return false;
+		}
+		if (!freeFrames.empty())
+		{
+			std::swap(frame, freeFrames.back());
+			freeFrames.pop_back();
+		}
+	}
+
+	// Copy without holding the lock
+	frame.tick = tick;
+	frame.x.resize(positions.size());
+	frame.y.resize(positions.size());
+	positions.copy(frame.x.data(), frame.y.data());
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queue.push_back(Frame());
+		std::swap(queue.back(), frame);
+	}
+	wakeup.notify_one();
+	return true;
+}
+
+void Ped::PositionStreamer::writerLoop()
+{
+	// A consumer that goes away must not kill the simulation: with
+	// SIGPIPE blocked in this thread, writes fail with EPIPE instead
+	sigset_t pipe;
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe, NULL);
+
+	std::unique_lock<std::mutex> guard(lock);
+	while (true)
+	{
+		wakeup.wait(guard, [this] { return stopping || !queue.empty(); });
+		if (queue.empty())
+		{
+			return;
+		}
+
+		Frame frame;
+		std::swap(frame, queue.front());
+		queue.pop_front();
+
+		guard.unlock();
+		bool sent = (fd >= 0 || connect()) && send(frame);
+		guard.lock();
+
+		if (sent)
+		{
+			sentFrames++;
+		}
+		else
+		{
+			droppedFrames++;
+		}
+		freeFrames.push_back(Frame());
+		std::swap(freeFrames.back(), frame);
+	}
+}
+
+bool Ped::PositionStreamer::connect()
+{
+	// Nobody was listening a moment ago: drop the frame without trying
+	const auto now = std::chrono::steady_clock::now();
+	if (now < nextConnect)
+	{
+		return false;
+	}
+
+	if (target.compare(0, 5, "unix:") == 0)
+	{
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, target.c_str() + 5, sizeof(address.sun_path) - 1);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && ::connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	else
+	{
+		// Non-blocking open: a pipe without a reader fails right away
+		// instead of blocking until someone shows up
+		fd = open(target.c_str(), O_WRONLY | O_CREAT | O_NONBLOCK, 0644);
+		if (fd >= 0)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+		}
+	}
+
+	if (fd < 0)
+	{
+		nextConnect = now + connectDelay;
+		connectDelay = std::min(2 * connectDelay, CONNECT_DELAY_MAX);
+		return false;
+	}
+	connectDelay = CONNECT_DELAY_MIN;
+
+	// A new consumer starts with a keyframe
+	framesSinceKeyframe = 0;
+	return true;
+}
+
+void Ped::PositionStreamer::disconnect()
+{
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+}
+
+bool Ped::PositionStreamer::send(const Frame &frame)
+{
+	const size_t n = frame.x.size();
+	StreamMessageHeader header;
+	memset(&header, 0, sizeof(header));
+	header.agentCount = (uint32_t) n;
+	header.tick = frame.tick;
+
+	size_t bytes = 0;
+	if (framesSinceKeyframe == 0)
+	{
+		header.type = 'K';
+		memcpy(encoded.data(), frame.x.data(), n * sizeof(int32_t));
+		memcpy(encoded.data() + n * sizeof(int32_t), frame.y.data(), n * sizeof(int32_t));
+		bytes = 2 * n * sizeof(int32_t);
+	}
+	else
+	{
+		header.type = 'D';
+		unsigned char *codes = encoded.data();
+		const size_t codeBytes = (n + 1) / 2;
+		memset(codes, 0, codeBytes);
+
+		// Escapes are collected behind the codes, their count goes in between
+		uint32_t escapes = 0;
+		unsigned char *escape = codes + codeBytes + sizeof(uint32_t);
+		for (size_t i = 0; i < n; i++)
+		{
+			const int dx = frame.x[i] - sentX[i];
+			const int dy = frame.y[i] - sentY[i];
+			unsigned int cx = dx == 0 ? CODE_SAME : (dx == 1 ? CODE_PLUS : (dx == -1 ? CODE_MINUS : CODE_ESCAPE));
+			unsigned int cy = dy == 0 ? CODE_SAME : (dy == 1 ? CODE_PLUS : (dy == -1 ? CODE_MINUS : CODE_ESCAPE));
+
+			// Escapes carry both coordinates
+			if (cx == CODE_ESCAPE || cy == CODE_ESCAPE)
+			{
+				cx = cy = CODE_ESCAPE;
+				// Room for escapes: a delta with escapes for more than half
+				// of the agents is larger than a keyframe, send one instead
+				if (escape + 12 > encoded.data() + encoded.size())
+				{
+					framesSinceKeyframe = 0;
+					return send(frame);
+				}
+				uint32_t agent = (uint32_t) i;
+				memcpy(escape, &agent, 4);
+				memcpy(escape + 4, &frame.x[i], 4);
+				memcpy(escape + 8, &frame.y[i], 4);
+				escape += 12;
+				escapes++;
+			}
+			codes[i / 2] |= (unsigned char) ((cx | (cy << 2)) << ((i & 1) * 4));
+		}
+		memcpy(codes + codeBytes, &escapes, sizeof(uint32_t));
+		bytes = escape - codes;
+	}
+	header.payloadBytes = bytes;
+
+	if (!writeAll(&header, sizeof(header)) || !writeAll(encoded.data(), bytes))
+	{
+		// The consumer went away: reconnect (with a keyframe) next time
+		disconnect();
+		return false;
+	}
+
+	sentX = frame.x;
+	sentY = frame.y;
+	framesSinceKeyframe = (framesSinceKeyframe + 1) % keyframeEvery;
+	return true;
+}
+
+bool Ped::PositionStreamer::writeAll(const void *data, size_t bytes)
+{
+	const char *p = (const char*) data;
+	while (bytes > 0)
+	{
+		ssize_t n = write(fd, p, bytes);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return false;
+		}
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+bool Ped::PositionStreamReader::readAll(void *data, size_t bytes)
+{
+	char *p = (char*) data;
+	while (bytes > 0)
+	{
+		ssize_t n = read(fd, p, bytes);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return false;
+		}
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+bool Ped::PositionStreamReader::next(long &tick, std::vector<int32_t> &x, std::vector<int32_t> &y)
+{
+	while (true)
+	{
+		StreamMessageHeader header;
+		if (!readAll(&header, sizeof(header)))
+		{
+			return false;
+		}
+
+		// The payload has to fit the agent count: the positions of a
+		// keyframe, the codes, count and escapes of a delta
+		const size_t n = header.agentCount;
+		const size_t codeBytes = (n + 1) / 2;
+		const bool fits = header.type == 'K' ? header.payloadBytes == 2 * n * sizeof(int32_t)
+			: header.type == 'D' && header.payloadBytes >= codeBytes + sizeof(uint32_t)
+				&& (header.payloadBytes - codeBytes - sizeof(uint32_t)) % 12 == 0
+				&& (header.payloadBytes - codeBytes - sizeof(uint32_t)) / 12 <= n;
+		if (!fits)
+		{
+			return false;
+		}
+		payload.resize(header.payloadBytes);
+		if (!readAll(payload.data(), payload.size()))
+		{
+			return false;
+		}
+
+		if (header.type == 'K')
+		{
+			x.resize(n);
+			y.resize(n);
+			memcpy(x.data(), payload.data(), n * sizeof(int32_t));
+			memcpy(y.data(), payload.data() + n * sizeof(int32_t), n * sizeof(int32_t));
+		}
+		else if (header.type == 'D' && x.size() == n && y.size() == n)
+		{
+			static const int step[4] = { 0, 1, -1, 0 };
+			const unsigned char *codes = payload.data();
+			uint32_t escapes;
+			memcpy(&escapes, codes + codeBytes, sizeof(uint32_t));
+			if (codeBytes + sizeof(uint32_t) + (size_t) escapes * 12 != payload.size())
+			{
+				return false;
+			}
+
+			for (size_t i = 0; i < n; i++)
+			{
+				const unsigned int code = (codes[i / 2] >> ((i & 1) * 4)) & 15;
+				x[i] += step[code & 3];
+				y[i] += step[code >> 2];
+			}
+
+			const unsigned char *escape = codes + codeBytes + sizeof(uint32_t);
+			for (uint32_t e = 0; e < escapes; e++, escape += 12)
+			{
+				uint32_t agent;
+				memcpy(&agent, escape, 4);
+				if (agent >= n)
+				{
+					return false;
+				}
+				memcpy(&x[agent], escape + 4, 4);
+				memcpy(&y[agent], escape + 8, 4);
+			}
+		}
+		else
+		{
+			// A delta before the first keyframe
+			continue;
+		}
+
+		tick = header.tick;
+		return true;
+	}
+}
+
+// Starts streaming the agent positions of every tick to target
+void Ped::Model::enablePositionStream(const char *target, int keyframeEvery)
+{
+	delete positionStreamer;
+	positionStreamer = new Ped::PositionStreamer(target, agents, keyframeEvery);
+}
@@ -0,0 +1,129 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// PositionStreamer sends the agent positions of every tick to a local
+// consumer (a live dashboard) through a named pipe or a UNIX domain
+// socket. Agents move at most one cell per axis and tick, so after a
+// keyframe with all positions every tick is sent as a 2 bit code per
+// axis, with the rare larger jumps (e.g. after a restore) sent as
+// absolute escapes. A keyframe is repeated every keyframeEvery frames
+// and after every reconnect, so consumers can join at any time.
+//
+// Positions are copied at the end of a tick (see ped_positions.h);
+// encoding and sending happen on a background thread. When the
+// consumer is slow, frames are dropped rather than stalling the
+// simulation, and the next frame is encoded against the last frame
+// that was actually sent. When nobody is listening, frames are
+// dropped until a consumer connects; the attempts to connect back off
+// from 10 ms to a second while they fail.
+//
+// Stream layout (little endian), a sequence of messages:
+//   StreamMessageHeader
+//   keyframe ('K'):  int32 x[agentCount] | int32 y[agentCount]
+//   delta ('D'):     uint8 codes[(agentCount + 1) / 2]
+//                    | uint32 escapeCount
+//                    | escapeCount x (uint32 agent | int32 x | int32 y)
+// Each code nibble holds the x code in bits 0-1 and the y code in bits
+// 2-3 (agent 2k in the low nibble, 2k+1 in the high one); codes are
+// 0: unchanged, 1: +1, 2: -1, 3: see escapes.
+//
+#ifndef _ped_position_stream_h_
+#define _ped_position_stream_h_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+
+#include "ped_positions.h"
+
+namespace Ped {
+  struct StreamMessageHeader {
+    char type;
+    char reserved[3];
+    uint32_t agentCount;
+    int64_t tick;
+    uint64_t payloadBytes;
+  };
+
+  class PositionStreamer
+  {
+  public:
+    // target is a path (named pipe or file), or "unix:<path>" for a
+    // UNIX domain socket. Has to be created after Model::setup.
+    PositionStreamer(const char *target, const std::vector<Tagent*> &agents,
+      int keyframeEvery = 100, int maxQueuedFrames = 4);
+
+    // Sends the queued frames and disconnects
+    ~PositionStreamer();
+
+    // Copies the current positions into the queue.
+    // Returns false if the frame had to be dropped.
+    bool pushFrame(long tick);
+
+    long getSentFrames() const { return sentFrames; }
+    long getDroppedFrames() const { return droppedFrames; }
+
+  private:
+    struct Frame {
+      long tick;
+      std::vector<int32_t> x;
+      std::vector<int32_t> y;
+    };
+
+    std::string target;
+    AgentPositions positions;
+    int keyframeEvery;
+    int maxQueuedFrames;
+    // Counted by both threads, read without the lock
+    std::atomic<long> sentFrames;
+    std::atomic<long> droppedFrames;
+
+    std::deque<Frame> queue;
+    std::vector<Frame> freeFrames;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool stopping;
+    std::thread writer;
+
+    // Writer thread state: the connection and the positions the
+    // consumer has last seen
+    int fd;
+    std::chrono::steady_clock::time_point nextConnect;
+    std::chrono::milliseconds connectDelay;
+    int framesSinceKeyframe;
+    std::vector<int32_t> sentX;
+    std::vector<int32_t> sentY;
+    std::vector<unsigned char> encoded;
+
+    void writerLoop();
+    bool connect();
+    void disconnect();
+    bool send(const Frame &frame);
+    bool writeAll(const void *data, size_t bytes);
+  };
+
+  // Decodes a position stream, e.g. on the dashboard side
+  class PositionStreamReader
+  {
+  public:
+    PositionStreamReader(int fd) : fd(fd) {}
+
+    // Reads the next message and applies it. Returns false at the end
+    // of the stream and on malformed messages. Deltas that arrive
+    // before the first keyframe are skipped.
+    bool next(long &tick, std::vector<int32_t> &x, std::vector<int32_t> &y);
+
+  private:
+    int fd;
+    std::vector<unsigned char> payload;
+    bool readAll(void *data, size_t bytes);
+  };
+}
+
+#endif
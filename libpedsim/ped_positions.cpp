@@ -0,0 +1,58 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Position snapshots of many agents, see ped_positions.h
+//
+#include "ped_positions.h"
+#include "ped_agent.h"
+
+#include <cstring>
+#include <omp.h>
+
+// Below this many agents the copy is not worth the threads
+#define POSITIONS_PARALLEL_THRESHOLD 65536
+
+Ped::AgentPositions::AgentPositions(const std::vector<Tagent*> &agents, int stride) :
+	stride(stride > 0 ? stride : 1)
+{
+	columns = !agents.empty();
+	for (size_t i = 0; i < agents.size(); i += this->stride)
+	{
+		xs.push_back(agents[i]->getXStorage());
+		ys.push_back(agents[i]->getYStorage());
+		columns = columns && xs.back() == xs[0] + i && ys.back() == ys[0] + i;
+	}
+}
+
+void Ped::AgentPositions::copy(int32_t *x, int32_t *y) const
+{
+	const long n = (long) xs.size();
+	if (columns && stride == 1)
+	{
+		memcpy(x, xs[0], n * sizeof(int32_t));
+		memcpy(y, ys[0], n * sizeof(int32_t));
+	}
+	else if (columns)
+	{
+		const int *xcolumn = xs[0];
+		const int *ycolumn = ys[0];
+		const long step = stride;
+		#pragma omp parallel for schedule(static) if (n >= POSITIONS_PARALLEL_THRESHOLD)
+		for (long i = 0; i < n; i++)
+		{
+			x[i] = xcolumn[i * step];
+			y[i] = ycolumn[i * step];
+		}
+	}
+	else
+	{
+		const int * const *xp = xs.data();
+		const int * const *yp = ys.data();
+		#pragma omp parallel for schedule(static) if (n >= POSITIONS_PARALLEL_THRESHOLD)
+		for (long i = 0; i < n; i++)
+		{
+			x[i] = *xp[i];
+			y[i] = *yp[i];
+		}
+	}
+}
@@ -0,0 +1,46 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// AgentPositions copies the positions of a fixed selection of agents
+// (every stride-th one, in the order they had when the selection was
+// made) into plain x and y columns. It is shared by the exporters that
+// snapshot positions at the end of a tick.
+//
+// The agents' position storage is resolved once. When it is laid out
+// as columns (scenario images, SIMD arrays) the copy is a (strided)
+// memcpy, otherwise a gather through the resolved pointers. It has to
+// be created after Model::setup, which may move the positions.
+//
+#ifndef _ped_positions_h_
+#define _ped_positions_h_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace Ped {
+  class Tagent;
+
+  class AgentPositions
+  {
+  public:
+    AgentPositions(const std::vector<Tagent*> &agents, int stride = 1);
+
+    // Number of selected agents
+    size_t size() const { return xs.size(); }
+    int getStride() const { return stride; }
+
+    // Copies the current positions into x[size()] and y[size()]
+    void copy(int32_t *x, int32_t *y) const;
+
+  private:
+    std::vector<const int*> xs;
+    std::vector<const int*> ys;
+    int stride;
+
+    // Positions are columns: agent i at xs[0][i * stride]
+    bool columns;
+  };
+}
+
+#endif
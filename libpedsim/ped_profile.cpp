@@ -0,0 +1,210 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Per-phase tick timing and hardware counters, see ped_profile.h
+//
+#include "ped_profile.h"
+#include "ped_model.h"
+
+#include <cstring>
+#include <atomic>
+#include <iostream>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char * const PHASE_NAMES[Ped::PHASE_COUNT] = {
+	"tick",
+	"seq", "cthreads", "omp", "simd", "cuda",
+	"regions", "work", "barrier", "desired", "move", "neighbors",
+	"fields", "heatmap", "density", "congestion", "outputs"
+};
+
+static const char * const COUNTER_NAMES[Ped::COUNTER_COUNT] = {
+	"cycles", "instructions", "llc_misses", "branch_misses"
+};
+
+// The perf events behind the counters
+static const uint64_t COUNTER_EVENTS[Ped::COUNTER_COUNT] = {
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// Slots are handed out in the order threads first record a phase
+static std::atomic<int> nextThreadSlot(0);
+
+const char * Ped::phaseName(PHASE phase)
+{
+	return PHASE_NAMES[phase];
+}
+
+const char * Ped::counterName(COUNTER counter)
+{
+	return COUNTER_NAMES[counter];
+}
+
+// The counters of one thread: a perf event group, read with a single
+// system call. Closed when the thread ends.
+struct CounterGroup
+{
+	int fds[Ped::COUNTER_COUNT];
+	// 0: not opened yet, 1: open, -1: not available
+	int state;
+
+	CounterGroup() : state(0)
+	{
+		for (int c = 0; c < Ped::COUNTER_COUNT; c++) fds[c] = -1;
+	}
+	~CounterGroup()
+	{
+		for (int c = 0; c < Ped::COUNTER_COUNT; c++)
+		{
+			if (fds[c] >= 0) close(fds[c]);
+		}
+	}
+
+	bool open()
+	{
+		for (int c = 0; c < Ped::COUNTER_COUNT; c++)
+		{
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = COUNTER_EVENTS[c];
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+			// This thread, on any cpu; the first event leads the group
+			fds[c] = syscall(__NR_perf_event_open, &attr, 0, -1, c == 0 ? -1 : fds[0], 0);
+			if (fds[c] < 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+static thread_local CounterGroup counterGroup;
+
+bool Ped::PhaseProfile::readCounters(uint64_t *counts)
+{
+	if (counterGroup.state == 0)
+	{
+		counterGroup.state = counterGroup.open() ? 1 : -1;
+	}
+	if (counterGroup.state < 0)
+	{
+		return false;
+	}
+
+	// Group read: the number of events, then their values
+	uint64_t values[1 + COUNTER_COUNT];
+	if (read(counterGroup.fds[0], values, sizeof(values)) != (ssize_t) sizeof(values))
+	{
+		return false;
+	}
+	memcpy(counts, values + 1, COUNTER_COUNT * sizeof(uint64_t));
+	return true;
+}
+
+bool Ped::PhaseProfile::enableHardwareCounters()
+{
+	uint64_t counts[COUNTER_COUNT];
+	if (!readCounters(counts))
+	{
+		std::cout << "Warning: hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)." << std::endl;
+		return false;
+	}
+	hardwareCounters = true;
+	return true;
+}
+
+bool Ped::PhaseProfile::timesPhases()
+{
+#ifdef PED_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
+
+static thread_local int currentThreadSlot = -1;
+
+int Ped::PhaseProfile::threadSlot()
+{
+	if (currentThreadSlot < 0)
+	{
+		currentThreadSlot = newThreadSlot();
+	}
+	return currentThreadSlot;
+}
+
+int Ped::PhaseProfile::newThreadSlot()
+{
+	return nextThreadSlot.fetch_add(1) % MAX_THREADS;
+}
+
+void Ped::PhaseProfile::setThreadSlot(int slot)
+{
+	currentThreadSlot = slot;
+}
+
+Ped::PhaseTotals Ped::PhaseProfile::getTotals(PHASE phase) const
+{
+	PhaseTotals totals;
+	memset(&totals, 0, sizeof(totals));
+	const int threads = getThreadCount();
+	for (int t = 0; t < threads; t++)
+	{
+		totals.calls += slots[t].calls[phase];
+		totals.nanoseconds += slots[t].nanoseconds[phase];
+		for (int c = 0; c < COUNTER_COUNT; c++)
+		{
+			totals.counters[c] += slots[t].counters[phase][c];
+		}
+		totals.allocations += slots[t].allocations[phase];
+		totals.allocatedBytes += slots[t].allocatedBytes[phase];
+	}
+	return totals;
+}
+
+Ped::PhaseTotals Ped::PhaseProfile::getTotals(PHASE phase, int thread) const
+{
+	PhaseTotals totals;
+	totals.calls = slots[thread].calls[phase];
+	totals.nanoseconds = slots[thread].nanoseconds[phase];
+	memcpy(totals.counters, slots[thread].counters[phase], sizeof(totals.counters));
+	totals.allocations = slots[thread].allocations[phase];
+	totals.allocatedBytes = slots[thread].allocatedBytes[phase];
+	return totals;
+}
+
+int Ped::PhaseProfile::getThreadCount() const
+{
+	const int used = nextThreadSlot.load();
+	return used < MAX_THREADS ? used : MAX_THREADS;
+}
+
+void Ped::PhaseProfile::reset()
+{
+	memset(slots, 0, sizeof(slots));
+}
+
+const Ped::PhaseProfile * Ped::Model::getPhaseProfile() const
+{
+	return phaseProfile;
+}
+
+bool Ped::Model::enableHardwareCounters()
+{
+	return phaseProfile != NULL && phaseProfile->enableHardwareCounters();
+}
+
+void Ped::Model::resetPhaseProfile()
+{
+	if (phaseProfile != NULL)
+	{
+		phaseProfile->reset();
+	}
+}
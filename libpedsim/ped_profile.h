@@ -0,0 +1,227 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Per-phase timing of Model::tick(). The phases of a tick and the
+// backends are wrapped in scoped timers (PED_PROFILE_SCOPE) that add
+// their elapsed time to a PhaseProfile. Every thread has its own
+// cache line aligned slot of counters, so timing never takes a lock
+// and threads do not share cache lines.
+//
+// The timers only exist when libpedsim is built with PED_PROFILE
+// defined (make PROFILE=1); otherwise they compile to nothing and
+// Model::getPhaseProfile() returns NULL.
+//
+// Phases nest: a backend contains the desired position and move
+// phases of its agents, and a move contains its neighbor search.
+// The work phase is one thread's share of a parallel backend (an OMP
+// region or a CTHREADS chunk), timed on the thread that did it; the
+// barrier phase is the time a thread then waits for the others.
+//
+// Optionally, the phases also count hardware events (cycles,
+// instructions, last level cache misses, branch misses) with Linux
+// perf_event_open. Every thread opens its own counters the first time
+// it runs a phase; they only count that thread, in user space. The
+// per-agent phases (desired, move, neighbors) are too short for the
+// counters to be read around them and only get timed.
+//
+// The same phases (except the per-agent ones) can also be recorded
+// as a timeline, see ped_trace.h.
+//
+// With PED_ALLOC_STATS (make ALLOC_STATS=1, which implies PROFILE=1),
+// libpedsim replaces the global operator new, and every allocation
+// made with it is counted in the innermost phase the allocating
+// thread is in. Allocations outside the phases, and those made with
+// malloc, are not counted.
+//
+#ifndef _ped_profile_h_
+#define _ped_profile_h_
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+namespace Ped {
+  enum PHASE {
+    // The whole tick
+    PHASE_TICK,
+    // The backends (moving the agents)
+    PHASE_SEQ, PHASE_CTHREADS, PHASE_OMP, PHASE_SIMD, PHASE_CUDA,
+    // Inside the backends
+    PHASE_REGIONS, PHASE_WORK, PHASE_BARRIER, PHASE_DESIRED, PHASE_MOVE, PHASE_NEIGHBORS,
+    // After the agents moved
+    PHASE_FIELDS, PHASE_HEATMAP, PHASE_DENSITY, PHASE_CONGESTION, PHASE_OUTPUTS,
+    PHASE_COUNT
+  };
+
+  const char * phaseName(PHASE phase);
+
+  // Hardware events counted per phase
+  enum COUNTER { COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_LLC_MISSES, COUNTER_BRANCH_MISSES, COUNTER_COUNT };
+
+  const char * counterName(COUNTER counter);
+
+  struct PhaseTotals {
+    uint64_t calls;
+    uint64_t nanoseconds;
+    uint64_t counters[COUNTER_COUNT];
+    // Allocations through operator new (PED_ALLOC_STATS only)
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+
+    // Instructions per cycle (0 without counters)
+    double ipc() const { return counters[COUNTER_CYCLES] > 0 ? (double) counters[COUNTER_INSTRUCTIONS] / counters[COUNTER_CYCLES] : 0.0; }
+  };
+
+  class TraceRecorder;
+  class PhaseProfile;
+
+  // The innermost phase of the calling thread, for the allocation
+  // counters (PED_ALLOC_STATS)
+  struct CurrentPhase {
+    PhaseProfile *profile;
+    PHASE phase;
+  };
+  extern thread_local CurrentPhase currentPhase;
+
+  class PhaseProfile
+  {
+  public:
+    // Threads beyond this share slots (and may lose counts)
+    static const int MAX_THREADS = 256;
+
+    PhaseProfile() { reset(); }
+
+    // Called by the thread that ran the phase
+    void add(PHASE phase, uint64_t nanoseconds) {
+      Slot &slot = slots[threadSlot()];
+      slot.calls[phase]++;
+      slot.nanoseconds[phase] += nanoseconds;
+    }
+    void addCounters(PHASE phase, const uint64_t *counts) {
+      Slot &slot = slots[threadSlot()];
+      for (int c = 0; c < COUNTER_COUNT; c++) slot.counters[phase][c] += counts[c];
+    }
+    void addAllocation(PHASE phase, uint64_t bytes) {
+      Slot &slot = slots[threadSlot()];
+      slot.allocations[phase]++;
+      slot.allocatedBytes[phase] += bytes;
+    }
+
+    // Whether libpedsim has the phase timers (built with PED_PROFILE)
+    // and counts allocations (built with PED_ALLOC_STATS)
+    static bool timesPhases();
+    static bool countsAllocations();
+
+    // Turns on the hardware counters. Returns false (and leaves them
+    // off) if this thread can not open them, e.g. because of
+    // perf_event_paranoid or a virtual machine without a PMU.
+    bool enableHardwareCounters();
+    bool hasHardwareCounters() const { return hardwareCounters; }
+
+    // Phases that are long enough to be counted and traced (all but
+    // the per-agent ones)
+    static bool isCoarse(PHASE phase) { return phase != PHASE_DESIRED && phase != PHASE_MOVE && phase != PHASE_NEIGHBORS; }
+
+    // Records the coarse phases in trace as well (NULL to stop)
+    void setTrace(TraceRecorder *trace_) { trace = trace_; }
+    TraceRecorder * getTrace() const { return trace; }
+
+    // Reads the calling thread's counters (opening them if needed).
+    // Returns false if they are not available on this thread.
+    static bool readCounters(uint64_t *counts);
+
+    // Summed over all threads, or for one thread slot. Read between
+    // ticks: the counters are not synchronized with running phases.
+    PhaseTotals getTotals(PHASE phase) const;
+    PhaseTotals getTotals(PHASE phase, int thread) const;
+
+    // Number of slots that were used so far (1 + the highest slot)
+    int getThreadCount() const;
+
+    void reset();
+
+    // The calling thread's slot, drawn when the thread first records
+    // a phase. A short-lived thread that stands in for an earlier one
+    // (the CTHREADS worker of the same index) takes over a slot drawn
+    // with newThreadSlot(), so the threads of every tick do not use up
+    // new slots.
+    static int threadSlot();
+    static int newThreadSlot();
+    static void setThreadSlot(int slot);
+
+  private:
+    struct alignas(64) Slot {
+      uint64_t calls[PHASE_COUNT];
+      uint64_t nanoseconds[PHASE_COUNT];
+      uint64_t counters[PHASE_COUNT][COUNTER_COUNT];
+      uint64_t allocations[PHASE_COUNT];
+      uint64_t allocatedBytes[PHASE_COUNT];
+    };
+    Slot slots[MAX_THREADS];
+    bool hardwareCounters = false;
+    TraceRecorder *trace = NULL;
+  };
+
+  // Adds the lifetime of the object to a phase (if profile is set).
+  // arg is shown with the phase in a trace (the tick, the region).
+  class ScopedPhase
+  {
+  public:
+    ScopedPhase(PhaseProfile *profile_, PHASE phase_, int64_t arg_ = -1) : profile(profile_), phase(phase_), arg(arg_), counting(false) {
+      if (profile != NULL) {
+#ifdef PED_ALLOC_STATS
+        outer = currentPhase;
+        currentPhase.profile = profile;
+        currentPhase.phase = phase;
+#endif
+        counting = profile->hasHardwareCounters() && PhaseProfile::isCoarse(phase) && PhaseProfile::readCounters(startCounts);
+        start = std::chrono::steady_clock::now();
+      }
+    }
+    ~ScopedPhase() {
+      if (profile != NULL) {
+#ifdef PED_ALLOC_STATS
+        currentPhase = outer;
+#endif
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        profile->add(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        uint64_t counts[COUNTER_COUNT];
+        if (counting && PhaseProfile::readCounters(counts)) {
+          for (int c = 0; c < COUNTER_COUNT; c++) counts[c] -= startCounts[c];
+          profile->addCounters(phase, counts);
+        }
+        if (profile->getTrace() != NULL && PhaseProfile::isCoarse(phase)) {
+          record(elapsed);
+        }
+      }
+    }
+
+  private:
+    PhaseProfile *profile;
+    PHASE phase;
+    int64_t arg;
+    bool counting;
+    uint64_t startCounts[COUNTER_COUNT];
+    std::chrono::steady_clock::time_point start;
+#ifdef PED_ALLOC_STATS
+    CurrentPhase outer;
+#endif
+
+    // Adds the phase to the trace (in ped_trace.cpp, to keep the
+    // tracer out of this header)
+    void record(std::chrono::steady_clock::duration elapsed);
+  };
+}
+
+#define PED_PROFILE_CONCAT2(a, b) a##b
+#define PED_PROFILE_CONCAT(a, b) PED_PROFILE_CONCAT2(a, b)
+
+#ifdef PED_PROFILE
+#define PED_PROFILE_SCOPE(profile, phase) Ped::ScopedPhase PED_PROFILE_CONCAT(pedPhase, __LINE__)(profile, phase)
+#define PED_PROFILE_SCOPE_ARG(profile, phase, arg) Ped::ScopedPhase PED_PROFILE_CONCAT(pedPhase, __LINE__)(profile, phase, arg)
+#else
+#define PED_PROFILE_SCOPE(profile, phase) ((void) 0)
+#define PED_PROFILE_SCOPE_ARG(profile, phase, arg) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,144 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Parallel LSD radix sort, see ped_radix_sort.h
+//
+#include "ped_radix_sort.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <omp.h>
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Below this size the threads cost more than they save
+#define RADIX_PARALLEL_THRESHOLD 65536
+
+// Grows (never shrinks) a scratch buffer
+template <typename T>
+static T * reserveScratch(std::vector<T> &buffer, size_t n)
+{
+	if (buffer.size() < n)
+	{
+		buffer.resize(n);
+	}
+	return buffer.data();
+}
+
+static std::vector<uint32_t> & keyScratch(Ped::RadixSortScratch &scratch, uint32_t *) { return scratch.keys32; }
+static std::vector<uint64_t> & keyScratch(Ped::RadixSortScratch &scratch, uint64_t *) { return scratch.keys64; }
+
+template <typename Key>
+static void radixSort(Key *keys, uint32_t *values, size_t n, int keyBits, Ped::RadixSortScratch &scratch)
+{
+	if (n < 2 || keyBits <= 0)
+	{
+		return;
+	}
+
+	Key *srcKeys = keys, *dstKeys = reserveScratch(keyScratch(scratch, keys), n);
+	uint32_t *srcValues = values, *dstValues = reserveScratch(scratch.values, n);
+
+	const int threads = n < RADIX_PARALLEL_THRESHOLD ? 1 : omp_get_max_threads();
+	// offsets[t][d]: where thread t writes its first key with digit d
+	size_t *offsets = reserveScratch(scratch.offsets, (size_t) threads * RADIX_BUCKETS);
+
+	for (int shift = 0; shift < keyBits; shift += RADIX_BITS)
+	{
+		bool skip = false;
+
+		#pragma omp parallel num_threads(threads)
+		{
+			const int t = omp_get_thread_num();
+			const int nthreads = omp_get_num_threads();
+			const size_t first = n * t / nthreads;
+			const size_t last = n * (t + 1) / nthreads;
+			size_t *count = &offsets[(size_t) t * RADIX_BUCKETS];
+
+			// Histogram of this thread's chunk
+			std::fill(count, count + RADIX_BUCKETS, 0);
+			for (size_t i = first; i < last; i++)
+			{
+				count[(srcKeys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+			}
+
+			#pragma omp barrier
+			#pragma omp single
+			{
+				// Exclusive prefix sum over (digit, thread), which keeps the sort stable
+				size_t sum = 0;
+				for (int d = 0; d < RADIX_BUCKETS; d++)
+				{
+					const size_t digitStart = sum;
+					for (int u = 0; u < nthreads; u++)
+					{
+						size_t c = offsets[(size_t) u * RADIX_BUCKETS + d];
+						offsets[(size_t) u * RADIX_BUCKETS + d] = sum;
+						sum += c;
+					}
+					// All keys (of all threads) share this digit: nothing
+					// to do in this pass
+					if (sum - digitStart == n)
+					{
+						skip = true;
+					}
+				}
+			}
+
+			if (!skip)
+			{
+				for (size_t i = first; i < last; i++)
+				{
+					size_t pos = count[(srcKeys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+					dstKeys[pos] = srcKeys[i];
+					dstValues[pos] = srcValues[i];
+				}
+			}
+		}
+
+		if (!skip)
+		{
+			std::swap(srcKeys, dstKeys);
+			std::swap(srcValues, dstValues);
+		}
+	}
+
+	// After an odd number of passes the result is in the buffers
+	if (srcKeys != keys)
+	{
+		memcpy(keys, srcKeys, n * sizeof(Key));
+		memcpy(values, srcValues, n * sizeof(uint32_t));
+	}
+}
+
+size_t Ped::RadixSortScratch::bytes() const
+{
+	return keys32.capacity() * sizeof(uint32_t) + keys64.capacity() * sizeof(uint64_t)
+		+ values.capacity() * sizeof(uint32_t) + offsets.capacity() * sizeof(size_t);
+}
+
+void Ped::radixSortPairs(uint32_t *keys, uint32_t *values, size_t n, int keyBits, RadixSortScratch *scratch)
+{
+	RadixSortScratch local;
+	radixSort(keys, values, n, std::min(keyBits, 32), scratch != NULL ? *scratch : local);
+}
+
+void Ped::radixSortPairs(uint64_t *keys, uint32_t *values, size_t n, int keyBits, RadixSortScratch *scratch)
+{
+	RadixSortScratch local;
+	radixSort(keys, values, n, std::min(keyBits, 64), scratch != NULL ? *scratch : local);
+}
+
+int Ped::radixKeyBits(uint64_t maxKey)
+{
+	int bits = 0;
+	while (maxKey != 0)
+	{
+		bits++;
+		maxKey >>= 1;
+	}
+	return bits;
+}
@@ -0,0 +1,41 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Parallel LSD radix sort of (key, value) pairs, e.g. a packed
+// position or cell id together with an agent index. The sort is
+// stable, makes one pass over the data per 8 bits of key and runs
+// each pass with OpenMP: per-thread histograms, one prefix sum, and
+// a per-thread scatter.
+//
+#ifndef _ped_radix_sort_h_
+#define _ped_radix_sort_h_ 1
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace Ped {
+	// The buffers of a sort. A caller that sorts repeatedly (e.g. once
+	// per tick) keeps one and passes it to every sort; the buffers only
+	// grow, so sorts of the same size allocate nothing.
+	struct RadixSortScratch {
+		std::vector<uint32_t> keys32;
+		std::vector<uint64_t> keys64;
+		std::vector<uint32_t> values;
+		std::vector<size_t> offsets;
+
+		size_t bytes() const;
+	};
+
+	// Sorts keys ascending and applies the same permutation to values.
+	// Only the low keyBits bits of the keys are considered, so small
+	// keys (e.g. x coordinates) need fewer passes. Without scratch, the
+	// buffers are allocated for this sort only.
+	void radixSortPairs(uint32_t *keys, uint32_t *values, size_t n, int keyBits = 32, RadixSortScratch *scratch = NULL);
+	void radixSortPairs(uint64_t *keys, uint32_t *values, size_t n, int keyBits = 64, RadixSortScratch *scratch = NULL);
+
+	// Number of bits needed to represent maxKey
+	int radixKeyBits(uint64_t maxKey);
+}
+
+#endif
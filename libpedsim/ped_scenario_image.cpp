@@ -0,0 +1,356 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Binary scenario images and the xml scenario cache, see ped_scenario_image.h
+//
+#include "ped_scenario_image.h"
+#include "ped_scenario_loader.h"
+#include "ped_agent.h"
+#include "ped_waypoint.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char IMAGE_MAGIC[8] = "PEDSCN1";
+
+// Columns start on cache line boundaries
+static uint64_t align64(uint64_t offset)
+{
+	return (offset + 63) & ~(uint64_t) 63;
+}
+
+// Does a column of count elements at offset lie within the image?
+static bool columnFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t size)
+{
+	return offset <= size && count <= (size - offset) / elementSize;
+}
+
+// 64 bit FNV-1a hash of the file contents; 0 if it can not be read
+static uint64_t hashFile(const std::string &filename)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		if (fd >= 0) close(fd);
+		return 0;
+	}
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return 0;
+	}
+
+	uint64_t hash = 14695981039346656037ULL;
+	const unsigned char *p = (const unsigned char*) data;
+	for (off_t i = 0; i < info.st_size; i++)
+	{
+		hash ^= p[i];
+		hash *= 1099511628211ULL;
+	}
+	munmap(data, info.st_size);
+	return hash;
+}
+
+// Does the file start like an image?
+static bool isImageFile(const std::string &filename)
+{
+	char magic[8] = { 0 };
+	FILE *file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	size_t n = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+	return n == sizeof(magic) && memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+Ped::ScenarioImage * Ped::ScenarioImage::open(const std::string &filename, unsigned int seed)
+{
+	if (isImageFile(filename))
+	{
+		return map(filename);
+	}
+
+	// An xml scenario: try the cache first
+	uint64_t hash = hashFile(filename);
+	if (hash == 0)
+	{
+		std::cout << "Warning: file not found or invalid: " << filename << "." << std::endl;
+		return NULL;
+	}
+
+	const std::string cacheFile = filename + ".pedc";
+	if (isImageFile(cacheFile))
+	{
+		ScenarioImage *cached = map(cacheFile);
+		if (cached != NULL && cached->matches(hash, seed))
+		{
+			return cached;
+		}
+		delete cached;
+	}
+
+	// Parse the xml, and keep the result for the next run
+	Ped::ScenarioLoader loader(filename, seed);
+	if (!loader.isValid())
+	{
+		return NULL;
+	}
+	std::vector<Ped::Tagent*> agents = loader.getAgents();
+	std::vector<Ped::Twaypoint*> waypoints = loader.getWaypoints();
+
+	ScenarioImage *image = build(agents, waypoints, hash, seed);
+	if (!image->save(cacheFile))
+	{
+		std::cout << "Note: could not write scenario cache " << cacheFile << "." << std::endl;
+	}
+
+	// The image holds everything; the loaded objects are not needed anymore
+	for (auto agent : agents) delete agent;
+	for (auto waypoint : waypoints) delete waypoint;
+
+	return image;
+}
+
+bool Ped::ScenarioImage::write(const std::string &filename, const std::vector<Tagent*> &agents,
+	const std::vector<Twaypoint*> &waypoints, uint64_t contentHash, unsigned int seed)
+{
+	ScenarioImage *image = build(agents, waypoints, contentHash, seed);
+	bool ok = image->save(filename);
+	delete image;
+	return ok;
+}
+
+Ped::ScenarioImage * Ped::ScenarioImage::create(const std::string &filename, size_t agentCount, size_t routeLength,
+	size_t waypointCount, uint64_t contentHash, unsigned int seed)
+{
+	uint64_t size;
+	ScenarioImageHeader h = layout(agentCount, routeLength, waypointCount, contentHash, seed, size);
+
+	int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, size) != 0)
+	{
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	ScenarioImage *image = new ScenarioImage();
+	image->base = (char*) data;
+	image->size = size;
+	image->mapped = true;
+	memcpy(image->base, &h, sizeof(h));
+	image->header = (const ScenarioImageHeader*) image->base;
+	return image;
+}
+
+Ped::ScenarioImage::~ScenarioImage()
+{
+	if (mapped)
+	{
+		munmap(base, size);
+	}
+	else
+	{
+		free(base);
+	}
+}
+
+// Places the columns one after the other, 64 byte aligned
+Ped::ScenarioImageHeader Ped::ScenarioImage::layout(size_t agentCount, size_t routeLength, size_t waypointCount,
+	uint64_t contentHash, unsigned int seed, uint64_t &size)
+{
+	ScenarioImageHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	h.version = VERSION;
+	h.seed = seed;
+	h.contentHash = contentHash;
+	h.agentCount = agentCount;
+	h.waypointCount = waypointCount;
+	h.routeLength = routeLength;
+	h.agentXOffset = align64(sizeof(h));
+	h.agentYOffset = align64(h.agentXOffset + agentCount * sizeof(int32_t));
+	h.routeStartOffset = align64(h.agentYOffset + agentCount * sizeof(int32_t));
+	h.routeOffset = align64(h.routeStartOffset + (agentCount + 1) * sizeof(uint32_t));
+	h.waypointXOffset = align64(h.routeOffset + routeLength * sizeof(uint32_t));
+	h.waypointYOffset = align64(h.waypointXOffset + waypointCount * sizeof(double));
+	h.waypointROffset = align64(h.waypointYOffset + waypointCount * sizeof(double));
+	size = align64(h.waypointROffset + waypointCount * sizeof(double));
+	return h;
+}
+
+Ped::ScenarioImage * Ped::ScenarioImage::map(const std::string &filename)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(ScenarioImageHeader))
+	{
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
+
+	// Private and writable: the agents may move in place without
+	// ever touching the file
+	void *data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	ScenarioImage *image = new ScenarioImage();
+	image->base = (char*) data;
+	image->size = info.st_size;
+	image->mapped = true;
+	image->header = (const ScenarioImageHeader*) data;
+
+	// Reject other versions, truncated files and routes that lead
+	// outside the route column or the waypoints
+	const ScenarioImageHeader *h = image->header;
+	const uint64_t size = image->size;
+	bool valid = memcmp(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0 && h->version == VERSION
+		&& h->agentCount < UINT32_MAX && h->routeLength <= UINT32_MAX && h->waypointCount <= UINT32_MAX
+		&& columnFits(h->agentXOffset, h->agentCount, sizeof(int32_t), size)
+		&& columnFits(h->agentYOffset, h->agentCount, sizeof(int32_t), size)
+		&& columnFits(h->routeStartOffset, h->agentCount + 1, sizeof(uint32_t), size)
+		&& columnFits(h->routeOffset, h->routeLength, sizeof(uint32_t), size)
+		&& columnFits(h->waypointXOffset, h->waypointCount, sizeof(double), size)
+		&& columnFits(h->waypointYOffset, h->waypointCount, sizeof(double), size)
+		&& columnFits(h->waypointROffset, h->waypointCount, sizeof(double), size);
+	if (valid)
+	{
+		const uint32_t *routeStart = image->getRouteStart();
+		const uint32_t *route = image->getRoute();
+		const int64_t agents = (int64_t) h->agentCount;
+		const int64_t routeLength = (int64_t) h->routeLength;
+		const uint32_t waypoints = (uint32_t) h->waypointCount;
+		valid = routeStart[0] == 0 && routeStart[agents] == h->routeLength;
+
+		int broken = 0;
+		#pragma omp parallel for schedule(static) reduction(|:broken)
+		for (int64_t i = 0; i < agents; i++)
+		{
+			broken |= routeStart[i] > routeStart[i + 1];
+		}
+		#pragma omp parallel for schedule(static) reduction(|:broken)
+		for (int64_t r = 0; r < routeLength; r++)
+		{
+			broken |= route[r] >= waypoints;
+		}
+		valid = valid && !broken;
+	}
+	if (!valid)
+	{
+		std::cout << "Warning: ignoring invalid or outdated scenario image " << filename << "." << std::endl;
+		delete image;
+		return NULL;
+	}
+
+	return image;
+}
+
+Ped::ScenarioImage * Ped::ScenarioImage::build(const std::vector<Tagent*> &agents,
+	const std::vector<Twaypoint*> &waypoints, uint64_t contentHash, unsigned int seed)
+{
+	std::unordered_map<const Ped::Twaypoint*, uint32_t> waypointIndex;
+	for (size_t i = 0; i < waypoints.size(); i++)
+	{
+		waypointIndex[waypoints[i]] = (uint32_t) i;
+	}
+
+	// Routes: the current destination (if any), then the remaining waypoints
+	std::vector<uint32_t> routeStart(agents.size() + 1, 0);
+	std::vector<uint32_t> route;
+	for (size_t i = 0; i < agents.size(); i++)
+	{
+		auto it = waypointIndex.find(agents[i]->getDest());
+		if (it != waypointIndex.end())
+		{
+			route.push_back(it->second);
+		}
+		for (size_t w = 0; w < agents[i]->getWaypointCount(); w++)
+		{
+			it = waypointIndex.find(agents[i]->getWaypoint(w));
+			if (it != waypointIndex.end())
+			{
+				route.push_back(it->second);
+			}
+		}
+		routeStart[i + 1] = (uint32_t) route.size();
+	}
+
+	uint64_t size;
+	ScenarioImageHeader h = layout(agents.size(), route.size(), waypoints.size(), contentHash, seed, size);
+
+	ScenarioImage *image = new ScenarioImage();
+	image->base = (char*) aligned_alloc(64, size);
+	image->size = size;
+	image->mapped = false;
+	memset(image->base, 0, size);
+	memcpy(image->base, &h, sizeof(h));
+	image->header = (const ScenarioImageHeader*) image->base;
+
+	int *x = image->getAgentX();
+	int *y = image->getAgentY();
+	for (size_t i = 0; i < agents.size(); i++)
+	{
+		x[i] = agents[i]->getX();
+		y[i] = agents[i]->getY();
+	}
+	memcpy(image->base + h.routeStartOffset, routeStart.data(), routeStart.size() * sizeof(uint32_t));
+	memcpy(image->base + h.routeOffset, route.data(), route.size() * sizeof(uint32_t));
+
+	double *wx = image->getWaypointX();
+	double *wy = image->getWaypointY();
+	double *wr = image->getWaypointR();
+	for (size_t i = 0; i < waypoints.size(); i++)
+	{
+		wx[i] = waypoints[i]->getx();
+		wy[i] = waypoints[i]->gety();
+		wr[i] = waypoints[i]->getr();
+	}
+
+	return image;
+}
+
+bool Ped::ScenarioImage::matches(uint64_t contentHash, unsigned int seed) const
+{
+	return header->contentHash == contentHash && header->seed == seed;
+}
+
+// Writes the image atomically (temporary file + rename), so that a
+// concurrent run never maps a half-written cache
+bool Ped::ScenarioImage::save(const std::string &filename) const
+{
+	const std::string tmp = filename + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	bool ok = fwrite(base, 1, size, file) == size;
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), filename.c_str()) != 0)
+	{
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
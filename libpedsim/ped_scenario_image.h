@@ -0,0 +1,107 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// ScenarioImage is a compact, versioned binary form of a scenario
+// (or of a snapshot of a running model) that can be memory-mapped
+// and used without parsing. All columns are stored one after the
+// other, each aligned to 64 bytes:
+//
+//   agent x, agent y          int32[agents]
+//   route start               uint32[agents + 1]  (into route)
+//   route                     uint32[routeLength] (waypoint indices)
+//   waypoint x, y, r          double[waypoints]
+//
+// Opening an xml scenario transparently goes through a cache file
+// (<scenario>.pedc) next to the xml. The cache is keyed by a hash of
+// the xml contents and the seed, and is rebuilt whenever either changes.
+//
+#ifndef _ped_scenario_image_h_
+#define _ped_scenario_image_h_ 1
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Ped {
+	class Tagent;
+	class Twaypoint;
+
+	struct ScenarioImageHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t seed;
+		uint64_t contentHash;
+		uint64_t agentCount;
+		uint64_t waypointCount;
+		uint64_t routeLength;
+
+		// Byte offsets of the columns from the start of the image
+		uint64_t agentXOffset;
+		uint64_t agentYOffset;
+		uint64_t routeStartOffset;
+		uint64_t routeOffset;
+		uint64_t waypointXOffset;
+		uint64_t waypointYOffset;
+		uint64_t waypointROffset;
+	};
+
+	class ScenarioImage {
+	public:
+		static const uint32_t VERSION = 1;
+
+		// Opens a binary image, or an xml scenario through its cache.
+		// Returns NULL if the file can not be read.
+		static ScenarioImage * open(const std::string &filename, unsigned int seed = 0);
+
+		// Creates an image file of the given dimensions and maps it
+		// (shared), so that a generator can fill in the columns directly.
+		// The file is complete once the image is deleted.
+		static ScenarioImage * create(const std::string &filename, size_t agentCount, size_t routeLength,
+			size_t waypointCount, uint64_t contentHash = 0, unsigned int seed = 0);
+
+		// Serializes agents (positions and remaining waypoints) and
+		// waypoints into an image file. Waypoints not in the list are dropped.
+		static bool write(const std::string &filename, const std::vector<Tagent*> &agents,
+			const std::vector<Twaypoint*> &waypoints, uint64_t contentHash = 0, unsigned int seed = 0);
+
+		~ScenarioImage();
+
+		size_t getAgentCount() const { return header->agentCount; }
+		size_t getWaypointCount() const { return header->waypointCount; }
+		uint64_t getContentHash() const { return header->contentHash; }
+
+		// The columns are writable. Images opened with open() are mapped
+		// privately, so writes only touch this process' copy of the pages.
+		int * getAgentX() const { return (int*) (base + header->agentXOffset); }
+		int * getAgentY() const { return (int*) (base + header->agentYOffset); }
+
+		// Waypoints of agent i: getRoute()[getRouteStart()[i] .. getRouteStart()[i+1])
+		uint32_t * getRouteStart() const { return (uint32_t*) (base + header->routeStartOffset); }
+		uint32_t * getRoute() const { return (uint32_t*) (base + header->routeOffset); }
+
+		double * getWaypointX() const { return (double*) (base + header->waypointXOffset); }
+		double * getWaypointY() const { return (double*) (base + header->waypointYOffset); }
+		double * getWaypointR() const { return (double*) (base + header->waypointROffset); }
+
+	private:
+		ScenarioImage() : base(NULL), size(0), header(NULL), mapped(false) {}
+
+		char *base;
+		size_t size;
+		const ScenarioImageHeader *header;
+
+		// Mapped from a file, or built in memory
+		bool mapped;
+
+		static ScenarioImageHeader layout(size_t agentCount, size_t routeLength, size_t waypointCount,
+			uint64_t contentHash, unsigned int seed, uint64_t &size);
+		static ScenarioImage * map(const std::string &filename);
+		static ScenarioImage * build(const std::vector<Tagent*> &agents,
+			const std::vector<Twaypoint*> &waypoints, uint64_t contentHash, unsigned int seed);
+		bool matches(uint64_t contentHash, unsigned int seed) const;
+		bool save(const std::string &filename) const;
+	};
+}
+
+#endif
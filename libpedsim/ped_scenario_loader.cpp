@@ -0,0 +1,343 @@
+//
+// pedsim - A microscopic pedestrian simulation system.
+// Copyright (c) 2003 - 2014 by Christian Gloor
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+#include "ped_scenario_loader.h"
+#include "ped_radix_sort.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Agents of one group are generated in chunks of this size, each with its
+// own generator, so that large groups are spread over the threads too
+#define AGENT_CHUNK 65536
+
+// The duplicate check uses an occupancy bitmap of up to this many 64 bit
+// words per agent (one bit per cell of the bounding box), and sorts the
+// cells of sparser scenarios
+#define BITMAP_WORDS_PER_AGENT 16
+
+// Returns the value of attribute name in the tag [tag, end), or NULL.
+// The value is not copied; it ends at the closing quote.
+static const char * findAttribute(const char *tag, const char *end, const char *name)
+{
+	const size_t len = strlen(name);
+	const char *p = tag;
+	while (p < end)
+	{
+		// Attribute names are preceded by whitespace and followed by '='
+		if ((p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n' || p[-1] == '\r')
+			&& p + len < end && memcmp(p, name, len) == 0)
+		{
+			const char *q = p + len;
+			while (q < end && (*q == ' ' || *q == '\t')) q++;
+			if (q < end && *q == '=')
+			{
+				q++;
+				while (q < end && (*q == ' ' || *q == '\t')) q++;
+				if (q < end && (*q == '"' || *q == '\''))
+				{
+					return q + 1;
+				}
+			}
+		}
+		p++;
+	}
+	return NULL;
+}
+
+static double readDouble(const char *tag, const char *end, const char *name)
+{
+	const char *value = findAttribute(tag, end, name);
+	return value != NULL ? strtod(value, NULL) : 0.0;
+}
+
+static std::string readString(const char *tag, const char *end, const char *name)
+{
+	const char *value = findAttribute(tag, end, name);
+	if (value == NULL)
+	{
+		return std::string();
+	}
+	const char *q = value;
+	while (q < end && *q != '"' && *q != '\'') q++;
+	return std::string(value, q - value);
+}
+
+// Tag name is [tag, tag + len): does it equal name?
+static bool isTag(const char *tag, size_t len, const char *name)
+{
+	return strlen(name) == len && memcmp(tag, name, len) == 0;
+}
+
+Ped::ScenarioLoader::ScenarioLoader(const std::string &filename, unsigned int seed) : valid(false), duplicates(0)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		std::cout << "Warning: file not found or invalid: " << filename << "." << std::endl;
+		if (fd >= 0) close(fd);
+		return;
+	}
+
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		std::cout << "Warning: could not map scenario file: " << filename << "." << std::endl;
+		return;
+	}
+	madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+	parse((const char*) data, info.st_size);
+	munmap(data, info.st_size);
+
+	generateAgents(seed);
+	valid = true;
+
+	if (duplicates > 0)
+	{
+		std::cout << "Note: removed " << duplicates << " duplicates from scenario." << std::endl;
+	}
+}
+
+std::vector<Ped::Twaypoint*> Ped::ScenarioLoader::getWaypoints() const
+{
+	std::vector<Ped::Twaypoint*> v;
+	for (auto p : waypoints)
+	{
+		v.push_back(p.second);
+	}
+	return v;
+}
+
+// Single pass over the mapped file, tag by tag
+void Ped::ScenarioLoader::parse(const char *data, size_t size)
+{
+	const char *p = data;
+	const char *end = data + size;
+
+	// Index into groups of the currently open agent tag, or -1
+	int current = -1;
+
+	while (p < end)
+	{
+		p = (const char*) memchr(p, '<', end - p);
+		if (p == NULL)
+		{
+			break;
+		}
+		p++;
+
+		// Comments and processing instructions
+		if (end - p >= 3 && memcmp(p, "!--", 3) == 0)
+		{
+			const char *close = (const char*) memmem(p, end - p, "-->", 3);
+			p = close != NULL ? close + 3 : end;
+			continue;
+		}
+		if (p < end && (*p == '?' || *p == '!'))
+		{
+			const char *close = (const char*) memchr(p, '>', end - p);
+			p = close != NULL ? close + 1 : end;
+			continue;
+		}
+
+		const char *tagEnd = (const char*) memchr(p, '>', end - p);
+		if (tagEnd == NULL)
+		{
+			break;
+		}
+
+		bool closing = *p == '/';
+		const char *name = closing ? p + 1 : p;
+		const char *nameEnd = name;
+		while (nameEnd < tagEnd && *nameEnd != ' ' && *nameEnd != '\t' && *nameEnd != '\n'
+			&& *nameEnd != '\r' && *nameEnd != '/')
+		{
+			nameEnd++;
+		}
+		size_t nameLen = nameEnd - name;
+		bool selfClosing = tagEnd[-1] == '/';
+
+		if (closing)
+		{
+			if (isTag(name, nameLen, "agent"))
+			{
+				current = -1;
+			}
+		}
+		// New waypoint definition
+		else if (isTag(name, nameLen, "waypoint"))
+		{
+			std::string id = readString(nameEnd, tagEnd, "id");
+			double x = readDouble(nameEnd, tagEnd, "x");
+			double y = readDouble(nameEnd, tagEnd, "y");
+			double r = readDouble(nameEnd, tagEnd, "r");
+			waypoints[id] = new Ped::Twaypoint(x, y, r);
+		}
+		// New agents to add to scenario
+		else if (isTag(name, nameLen, "agent"))
+		{
+			AgentGroup group;
+			group.x = readDouble(nameEnd, tagEnd, "x");
+			group.y = readDouble(nameEnd, tagEnd, "y");
+			group.n = (int) readDouble(nameEnd, tagEnd, "n");
+			group.dx = readDouble(nameEnd, tagEnd, "dx");
+			group.dy = readDouble(nameEnd, tagEnd, "dy");
+			groups.push_back(group);
+			current = selfClosing ? -1 : (int) groups.size() - 1;
+		}
+		// Add waypoint that was defined earlier to the current agents
+		else if (isTag(name, nameLen, "addwaypoint") && current >= 0)
+		{
+			std::string id = readString(nameEnd, tagEnd, "id");
+			groups[current].route.push_back(waypoints[id]);
+		}
+
+		p = tagEnd + 1;
+	}
+}
+
+void Ped::ScenarioLoader::generateAgents(unsigned int seed)
+{
+	// Where each group (and each chunk of a group) starts in the position arrays
+	std::vector<size_t> groupStart(groups.size() + 1, 0);
+	std::vector<std::pair<int, size_t> > chunks;
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		int n = groups[g].n > 0 ? groups[g].n : 0;
+		groupStart[g + 1] = groupStart[g] + n;
+		for (int c = 0; c < n; c += AGENT_CHUNK)
+		{
+			chunks.push_back(std::make_pair((int) g, (size_t) c));
+		}
+	}
+	const size_t total = groupStart.back();
+
+	std::vector<int> xs(total);
+	std::vector<int> ys(total);
+
+	// Every chunk has its own generator seeded from (seed, group, chunk),
+	// so the result does not depend on the number of threads
+	#pragma omp parallel for schedule(dynamic)
+	for (int c = 0; c < (int) chunks.size(); c++)
+	{
+		const AgentGroup &group = groups[chunks[c].first];
+		const size_t first = chunks[c].second;
+		const size_t last = std::min(first + AGENT_CHUNK, (size_t) group.n);
+
+		std::seed_seq seq = { seed, (unsigned int) chunks[c].first, (unsigned int) (first / AGENT_CHUNK) };
+		std::mt19937 rng(seq);
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+		const size_t offset = groupStart[chunks[c].first];
+		for (size_t i = first; i < last; i++)
+		{
+			xs[offset + i] = (int) (group.x + unit(rng) * group.dx - group.dx / 2);
+			ys[offset + i] = (int) (group.y + unit(rng) * group.dy - group.dy / 2);
+		}
+	}
+
+	// Do not allow agents to be on the same position: the first agent
+	// on a position wins. An occupancy bitmap over the bounding box keeps
+	// this a linear pass, as long as the bitmap is not much larger than
+	// the agents themselves.
+	int minX = 0, maxX = 0, minY = 0, maxY = 0;
+	if (total > 0)
+	{
+		minX = maxX = xs[0];
+		minY = maxY = ys[0];
+	}
+	#pragma omp parallel for reduction(min:minX,minY) reduction(max:maxX,maxY)
+	for (size_t i = 0; i < total; i++)
+	{
+		minX = std::min(minX, xs[i]);
+		maxX = std::max(maxX, xs[i]);
+		minY = std::min(minY, ys[i]);
+		maxY = std::max(maxY, ys[i]);
+	}
+
+	std::vector<char> keep(total, 1);
+	const uint64_t width = (uint64_t) (maxX - minX) + 1;
+	const uint64_t cells = width * ((uint64_t) (maxY - minY) + 1);
+	if ((cells + 63) / 64 <= BITMAP_WORDS_PER_AGENT * (uint64_t) std::max(total, (size_t) 1))
+	{
+		std::vector<uint64_t> taken((cells + 63) / 64, 0);
+		for (size_t i = 0; i < total; i++)
+		{
+			uint64_t cell = (uint64_t) (ys[i] - minY) * width + (xs[i] - minX);
+			uint64_t bit = (uint64_t) 1 << (cell & 63);
+			if (taken[cell >> 6] & bit)
+			{
+				keep[i] = 0;
+			}
+			taken[cell >> 6] |= bit;
+		}
+	}
+	else
+	{
+		// Sparse scenario, the bitmap would dwarf the agents: sort the
+		// cell ids instead. The sort is stable, so the first agent of a
+		// run of equal cells is the one that came first.
+		std::vector<uint64_t> cell(total);
+		std::vector<uint32_t> order(total);
+		#pragma omp parallel for schedule(static)
+		for (size_t i = 0; i < total; i++)
+		{
+			cell[i] = (uint64_t) (ys[i] - minY) * width + (xs[i] - minX);
+			order[i] = (uint32_t) i;
+		}
+		Ped::radixSortPairs(cell.data(), order.data(), total, Ped::radixKeyBits(cells - 1));
+		#pragma omp parallel for schedule(static)
+		for (size_t i = 1; i < total; i++)
+		{
+			if (cell[i] == cell[i - 1])
+			{
+				keep[order[i]] = 0;
+			}
+		}
+	}
+
+	// Compact the surviving agents and create them in parallel
+	std::vector<size_t> index;
+	std::vector<int> groupOf;
+	index.reserve(total);
+	groupOf.reserve(total);
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		for (size_t i = groupStart[g]; i < groupStart[g + 1]; i++)
+		{
+			if (keep[i])
+			{
+				index.push_back(i);
+				groupOf.push_back((int) g);
+			}
+		}
+	}
+	duplicates = (int) (total - index.size());
+
+	agents.resize(index.size());
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < index.size(); i++)
+	{
+		Ped::Tagent *a = new Ped::Tagent(xs[index[i]], ys[index[i]]);
+		for (auto waypoint : groups[groupOf[i]].route)
+		{
+			a->addWaypoint(waypoint);
+		}
+		agents[i] = a;
+	}
+}
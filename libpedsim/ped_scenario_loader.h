@@ -0,0 +1,62 @@
+//
+// pedsim - A microscopic pedestrian simulation system.
+// Copyright (c) 2003 - 2014 by Christian Gloor
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// ScenarioLoader reads a scenario xml file (waypoint, agent and
+// addwaypoint tags) without Qt. The file is memory-mapped and parsed
+// in a single pass, agents are generated in parallel with a seeded
+// random number generator per group, and agents that end up on the
+// same position are removed with an occupancy bitmap (or a radix sort
+// of their cells when the scenario is too sparse for a bitmap).
+//
+#ifndef _ped_scenario_loader_h_
+#define _ped_scenario_loader_h_ 1
+
+#include "ped_agent.h"
+#include "ped_waypoint.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+namespace Ped {
+	class ScenarioLoader {
+	public:
+		// Loads filename. The same seed always gives the same agents.
+		ScenarioLoader(const std::string &filename, unsigned int seed = 0);
+
+		// False if the file could not be read
+		bool isValid() const { return valid; }
+
+		// The created agents and waypoints. They are meant to be
+		// handed to Model::setup, which takes ownership.
+		const std::vector<Tagent*> & getAgents() const { return agents; }
+		std::vector<Twaypoint*> getWaypoints() const;
+
+		// Number of agents removed because their position was taken
+		int getDuplicates() const { return duplicates; }
+
+	private:
+		// An agent tag: n agents spread uniformly over a dx * dy box
+		// around (x, y), all sharing the same route
+		struct AgentGroup {
+			double x, y, dx, dy;
+			int n;
+			std::vector<Twaypoint*> route;
+		};
+
+		bool valid;
+		int duplicates;
+
+		std::map<std::string, Twaypoint*> waypoints;
+		std::vector<AgentGroup> groups;
+		std::vector<Tagent*> agents;
+
+		void parse(const char *data, size_t size);
+		void generateAgents(unsigned int seed);
+	};
+}
+
+#endif
@@ -0,0 +1,235 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Shared memory state export, see ped_shared_state.h
+//
+#include "ped_shared_state.h"
+#include "ped_model.h"
+
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char SHARED_MAGIC[8] = "PEDSHM1";
+
+static uint64_t align64(uint64_t offset)
+{
+	return (offset + 63) & ~(uint64_t) 63;
+}
+
+static Ped::SharedSlotHeader * slotHeader(const Ped::SharedStateHeader *header, int slot)
+{
+	return (Ped::SharedSlotHeader*) ((char*) header + header->slotOffset[slot]);
+}
+
+Ped::SharedStateWriter::SharedStateWriter(const char *name, const std::vector<Tagent*> &agents, int heatmapSize) :
+	name(name), positions(agents), header(NULL), size(0)
+{
+	create(heatmapSize);
+}
+
+Ped::SharedStateWriter::~SharedStateWriter()
+{
+	destroy();
+}
+
+bool Ped::SharedStateWriter::resize(int heatmapSize)
+{
+	destroy();
+	return create(heatmapSize);
+}
+
+bool Ped::SharedStateWriter::create(int heatmapSize)
+{
+	const char *name = this->name.c_str();
+	const uint64_t agentCount = positions.size();
+	const uint64_t xOffset = align64(sizeof(SharedSlotHeader));
+	const uint64_t yOffset = align64(xOffset + agentCount * sizeof(int32_t));
+	const uint64_t heatmapOffset = align64(yOffset + agentCount * sizeof(int32_t));
+	const uint64_t slotSize = align64(heatmapOffset + (uint64_t) heatmapSize * heatmapSize * sizeof(int32_t));
+	const uint64_t first = align64(sizeof(SharedStateHeader));
+	size = first + 2 * slotSize;
+
+	// Start from a fresh segment, readers of an old one keep theirs
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 || ftruncate(fd, size) != 0)
+	{
+		std::cerr << "Warning: could not create shared memory segment " << name << "." << std::endl;
+		if (fd >= 0)
+		{
+			close(fd);
+			shm_unlink(name);
+		}
+		return false;
+	}
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		std::cerr << "Warning: could not map shared memory segment " << name << "." << std::endl;
+		shm_unlink(name);
+		return false;
+	}
+
+	// ftruncate zero-fills, so both sequences start at 0 (stable, but
+	// latest = -1 keeps readers away until the first publish)
+	header = (SharedStateHeader*) data;
+	memcpy(header->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC));
+	header->version = VERSION;
+	header->heatmapSize = heatmapSize;
+	header->agentCount = agentCount;
+	header->slotSize = slotSize;
+	header->slotOffset[0] = first;
+	header->slotOffset[1] = first + slotSize;
+	header->xOffset = xOffset;
+	header->yOffset = yOffset;
+	header->heatmapOffset = heatmapOffset;
+	header->latest.store(-1, std::memory_order_release);
+	return true;
+}
+
+void Ped::SharedStateWriter::destroy()
+{
+	if (header != NULL)
+	{
+		munmap(header, size);
+		shm_unlink(name.c_str());
+		header = NULL;
+		size = 0;
+	}
+}
+
+void Ped::SharedStateWriter::publish(long tick, const int *heatmap)
+{
+	if (header == NULL)
+	{
+		return;
+	}
+
+	// Write the slot readers are not pointed to
+	const int slot = header->latest.load(std::memory_order_relaxed) == 0 ? 1 : 0;
+	SharedSlotHeader *s = slotHeader(header, slot);
+	char *base = (char*) s;
+
+	const uint64_t sequence = s->sequence.load(std::memory_order_relaxed);
+	s->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	s->tick = tick;
+	positions.copy((int32_t*) (base + header->xOffset), (int32_t*) (base + header->yOffset));
+	if (heatmap != NULL && header->heatmapSize > 0)
+	{
+		memcpy(base + header->heatmapOffset, heatmap, (size_t) header->heatmapSize * header->heatmapSize * sizeof(int32_t));
+	}
+
+	s->sequence.store(sequence + 2, std::memory_order_release);
+	header->latest.store(slot, std::memory_order_release);
+}
+
+// Whether bytes at offset fit into limit, without overflowing
+static bool fitsIn(uint64_t offset, uint64_t bytes, uint64_t limit)
+{
+	return offset <= limit && bytes <= limit - offset;
+}
+
+// The header of a segment that some other (or outdated) writer made is
+// not trusted: both slots and every array in them must fit
+static bool validLayout(const Ped::SharedStateHeader *h, uint64_t segmentSize)
+{
+	if (memcmp(h->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC)) != 0 || h->version != Ped::SharedStateWriter::VERSION
+		|| h->slotSize < sizeof(Ped::SharedSlotHeader) || h->agentCount > h->slotSize / sizeof(int32_t)
+		|| (uint64_t) h->heatmapSize * h->heatmapSize > h->slotSize / sizeof(int32_t))
+	{
+		return false;
+	}
+	const uint64_t positionBytes = h->agentCount * sizeof(int32_t);
+	const uint64_t heatmapBytes = (uint64_t) h->heatmapSize * h->heatmapSize * sizeof(int32_t);
+	return fitsIn(h->slotOffset[0], h->slotSize, segmentSize) && fitsIn(h->slotOffset[1], h->slotSize, segmentSize)
+		&& fitsIn(h->xOffset, positionBytes, h->slotSize) && fitsIn(h->yOffset, positionBytes, h->slotSize)
+		&& (h->heatmapSize == 0 || fitsIn(h->heatmapOffset, heatmapBytes, h->slotSize));
+}
+
+Ped::SharedStateReader::SharedStateReader(const char *name) : header(NULL), size(0)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(SharedStateHeader))
+	{
+		if (fd >= 0) close(fd);
+		return;
+	}
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return;
+	}
+
+	const SharedStateHeader *h = (const SharedStateHeader*) data;
+	if (!validLayout(h, info.st_size))
+	{
+		std::cout << "Warning: " << name << " is not a compatible pedsim state segment." << std::endl;
+		munmap(data, info.st_size);
+		return;
+	}
+	header = h;
+	size = info.st_size;
+}
+
+Ped::SharedStateReader::~SharedStateReader()
+{
+	if (header != NULL)
+	{
+		munmap((void*) header, size);
+	}
+}
+
+bool Ped::SharedStateReader::acquire(SharedStateView &view) const
+{
+	if (header == NULL)
+	{
+		return false;
+	}
+	const int slot = header->latest.load(std::memory_order_acquire);
+	if (slot < 0 || slot > 1)
+	{
+		return false;
+	}
+	const SharedSlotHeader *s = slotHeader(header, slot);
+	const uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+	if (sequence & 1)
+	{
+		// Lapped by the writer between the two loads
+		return false;
+	}
+
+	const char *base = (const char*) s;
+	view.tick = s->tick;
+	view.agentCount = header->agentCount;
+	view.heatmapSize = header->heatmapSize;
+	view.x = (const int32_t*) (base + header->xOffset);
+	view.y = (const int32_t*) (base + header->yOffset);
+	view.heatmap = header->heatmapSize > 0 ? (const int32_t*) (base + header->heatmapOffset) : NULL;
+	view.slot = slot;
+	view.sequence = sequence;
+
+	// The tick must belong to this sequence too
+	return validate(view);
+}
+
+bool Ped::SharedStateReader::validate(const SharedStateView &view) const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slotHeader(header, view.slot)->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
+
+// Starts publishing the state of every tick in shared memory
+void Ped::Model::enableSharedState(const char *name)
+{
+	delete sharedState;
+	sharedState = new Ped::SharedStateWriter(name, agents, heatmap != NULL ? heatmapSize : 0);
+}
@@ -0,0 +1,136 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// SharedState publishes the agent positions (and the raw heatmap, if
+// enabled) of every tick in a named POSIX shared memory segment, so
+// that analysis and visualization processes on the same host can read
+// them in place.
+//
+// The segment holds two slots. At the end of a tick the writer fills
+// the slot that readers are not directed to, guarded by the slot's
+// sequence counter (odd while it is being written), and then points
+// readers to it. The writer never waits for readers. A reader picks
+// the latest slot, remembers its sequence, uses the data in place and
+// then checks that the sequence has not changed; a reader that holds
+// on to a slot for longer than a tick sees its view invalidated and
+// simply retries.
+//
+// Positions are in the order of the agents when the segment was
+// created (see ped_positions.h). When the model's heatmap changes size
+// the writer replaces the segment with one of the new layout; readers
+// notice that the segment they have mapped no longer advances and
+// open it again.
+//
+// Segment layout:
+//   SharedStateHeader, padded to 64 bytes
+//   two slots of slotSize bytes at slotOffset[0] and slotOffset[1]:
+//     SharedSlotHeader                    at 0
+//     int32 x[agentCount]                 at xOffset
+//     int32 y[agentCount]                 at yOffset
+//     int32 heatmap[heatmapSize^2]        at heatmapOffset
+//
+#ifndef _ped_shared_state_h_
+#define _ped_shared_state_h_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "ped_positions.h"
+
+namespace Ped {
+  struct SharedSlotHeader {
+    // Even: stable, odd: being written
+    std::atomic<uint64_t> sequence;
+    int64_t tick;
+  };
+
+  struct SharedStateHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t heatmapSize;
+    uint64_t agentCount;
+    uint64_t slotSize;
+    uint64_t slotOffset[2];
+    uint64_t xOffset;
+    uint64_t yOffset;
+    uint64_t heatmapOffset;
+    // Slot that readers should use, or -1 before the first tick
+    std::atomic<int32_t> latest;
+  };
+
+  // The writer side, owned by the model
+  class SharedStateWriter
+  {
+  public:
+    static const uint32_t VERSION = 1;
+
+    // Creates (or replaces) the segment; name is a POSIX shm name
+    // such as "/pedsim". Has to be created after Model::setup.
+    SharedStateWriter(const char *name, const std::vector<Tagent*> &agents, int heatmapSize);
+
+    // Removes the segment; readers keep their mapping until they let go
+    ~SharedStateWriter();
+
+    bool isOpen() const { return header != NULL; }
+    int getHeatmapSize() const { return header != NULL ? (int) header->heatmapSize : 0; }
+
+    // Replaces the segment by one for a heatmap of the given size
+    // (0: none), for the same agents
+    bool resize(int heatmapSize);
+
+    // Publishes the current positions and heatmap (NULL if disabled),
+    // which has to be of the size the segment was created for
+    void publish(long tick, const int *heatmap);
+
+  private:
+    std::string name;
+    AgentPositions positions;
+    SharedStateHeader *header;
+    size_t size;
+
+    bool create(int heatmapSize);
+    void destroy();
+  };
+
+  // A consistent tick as seen by a reader, pointing into the segment
+  struct SharedStateView {
+    long tick;
+    size_t agentCount;
+    int heatmapSize;
+    const int32_t *x;
+    const int32_t *y;
+    // NULL if the writer has no heatmap
+    const int32_t *heatmap;
+
+    // For validate()
+    int slot;
+    uint64_t sequence;
+  };
+
+  class SharedStateReader
+  {
+  public:
+    SharedStateReader(const char *name);
+    ~SharedStateReader();
+
+    bool isOpen() const { return header != NULL; }
+
+    // Points view at the latest published tick. Returns false if
+    // nothing has been published yet (or the writer is mid-way and the
+    // other slot is not usable either; just try again).
+    bool acquire(SharedStateView &view) const;
+
+    // True if the data behind view has not been overwritten since
+    // acquire(); check this after using the data
+    bool validate(const SharedStateView &view) const;
+
+  private:
+    const SharedStateHeader *header;
+    size_t size;
+  };
+}
+
+#endif
@@ -0,0 +1,99 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// State hashing for comparing backends. Every agent is hashed on its
+// own (position and destination) and the agent hashes are added up,
+// so the hash does not depend on the order of the agents (which OMP
+// sorts every tick) and the agents can be hashed in parallel. One
+// pass over the agents costs far less than moving them.
+//
+#include "ped_model.h"
+#include "ped_waypoint.h"
+#include "ped_util.h"
+
+#include <cstring>
+#include <iostream>
+#include <omp.h>
+
+static inline uint64_t doubleBits(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+uint64_t Ped::Model::computeStateHash() const
+{
+	const int n = agents.size();
+	uint64_t sum = 0;
+
+	#pragma omp parallel for schedule(static) reduction(+:sum) if (n > 20000)
+	for (int i = 0; i < n; i++)
+	{
+		const Ped::Tagent *agent = agents[i];
+		uint64_t hash = Ped::mix64(((uint64_t) (uint32_t) agent->getX() << 32) | (uint32_t) agent->getY());
+		const Ped::Twaypoint *destination = agent->getDest();
+		if (destination != NULL)
+		{
+			hash = Ped::mix64(hash ^ doubleBits(destination->getx()));
+			hash = Ped::mix64(hash ^ doubleBits(destination->gety()));
+		}
+		else
+		{
+			hash = Ped::mix64(~hash);
+		}
+		sum += hash;
+	}
+
+	// Also tells apart crowds that only differ in size
+	return Ped::mix64(sum + (uint64_t) n);
+}
+
+bool Ped::Model::enableStateHash(const char *logFile, size_t historyTicks)
+{
+	if (logFile != NULL)
+	{
+		if (stateHashLog != NULL)
+		{
+			fclose(stateHashLog);
+		}
+		stateHashLog = fopen(logFile, "w");
+		if (stateHashLog == NULL)
+		{
+			std::cout << "Warning: could not open state hash log " << logFile << "." << std::endl;
+			return false;
+		}
+	}
+	stateHashing = true;
+	stateHashes.assign(historyTicks > 0 ? historyTicks : 1, 0);
+	hashedTicks = 0;
+	firstHashedTick = tickCount + 1;
+	return true;
+}
+
+bool Ped::Model::getStateHash(long tick, uint64_t &hash) const
+{
+	if (tick < firstHashedTick)
+	{
+		return false;
+	}
+	const size_t index = tick - firstHashedTick;
+	if (index >= hashedTicks || hashedTicks - index > stateHashes.size())
+	{
+		return false;
+	}
+	hash = stateHashes[index % stateHashes.size()];
+	return true;
+}
+
+// Called at the end of every tick while hashing is enabled
+void Ped::Model::recordStateHash()
+{
+	uint64_t hash = computeStateHash();
+	stateHashes[hashedTicks % stateHashes.size()] = hash;
+	hashedTicks++;
+	if (stateHashLog != NULL)
+	{
+		fprintf(stateHashLog, "%ld %016llx\n", tickCount, (unsigned long long) hash);
+	}
+}
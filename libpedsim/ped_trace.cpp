@@ -0,0 +1,145 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Per-thread timeline of the tick phases, see ped_trace.h
+//
+#include "ped_trace.h"
+#include "ped_model.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+Ped::TraceRecorder::TraceRecorder(size_t eventsPerThread) : capacity(eventsPerThread), origin(std::chrono::steady_clock::now())
+{
+	memset(buffers, 0, sizeof(buffers));
+}
+
+Ped::TraceRecorder::~TraceRecorder()
+{
+	for (int t = 0; t < PhaseProfile::MAX_THREADS; t++)
+	{
+		free(buffers[t].events);
+	}
+}
+
+void Ped::TraceRecorder::record(PHASE phase, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::duration duration, int64_t arg)
+{
+	Buffer &buffer = buffers[PhaseProfile::threadSlot()];
+	if (buffer.events == NULL)
+	{
+		// The only allocation of this thread's buffer
+		buffer.events = (Event*) malloc(capacity * sizeof(Event));
+		if (buffer.events == NULL)
+		{
+			buffer.dropped++;
+			return;
+		}
+	}
+	if (buffer.count == capacity)
+	{
+		buffer.dropped++;
+		return;
+	}
+
+	Event &event = buffer.events[buffer.count++];
+	event.begin = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - origin).count();
+	event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	event.arg = arg;
+	event.phase = phase;
+}
+
+size_t Ped::TraceRecorder::getDroppedEvents() const
+{
+	size_t dropped = 0;
+	for (int t = 0; t < PhaseProfile::MAX_THREADS; t++)
+	{
+		dropped += buffers[t].dropped;
+	}
+	return dropped;
+}
+
+// Name of the argument of a phase in the trace
+static const char * argName(Ped::PHASE phase)
+{
+	switch (phase)
+	{
+	case Ped::PHASE_TICK: return "tick";
+	case Ped::PHASE_WORK: return "region";
+	default: return "arg";
+	}
+}
+
+bool Ped::TraceRecorder::write(const char *filename) const
+{
+	FILE *file = fopen(filename, "w");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	// Complete events ("X") with microsecond timestamps; one row per
+	// thread slot
+	const int pid = (int) getpid();
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	bool first = true;
+	for (int t = 0; t < PhaseProfile::MAX_THREADS; t++)
+	{
+		const Buffer &buffer = buffers[t];
+		if (buffer.events == NULL)
+		{
+			continue;
+		}
+		fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+			first ? "" : ",\n", pid, t, t);
+		first = false;
+		for (size_t i = 0; i < buffer.count; i++)
+		{
+			const Event &event = buffer.events[i];
+			fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+				phaseName((PHASE) event.phase), pid, t, event.begin / 1000.0, event.duration / 1000.0);
+			if (event.arg >= 0)
+			{
+				fprintf(file, ",\"args\":{\"%s\":%lld}", argName((PHASE) event.phase), (long long) event.arg);
+			}
+			fprintf(file, "}");
+		}
+	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
+
+void Ped::ScopedPhase::record(std::chrono::steady_clock::duration elapsed)
+{
+	profile->getTrace()->record(phase, start, elapsed, arg);
+}
+
+// Starts recording the timeline, written to filename when the model
+// is destroyed
+void Ped::Model::enableTrace(const char *filename, size_t eventsPerThread)
+{
+	if (phaseProfile == NULL)
+	{
+		std::cout << "Note: tracing needs a libpedsim built with PED_PROFILE (make PROFILE=1)." << std::endl;
+		return;
+	}
+	delete traceRecorder;
+	traceRecorder = new Ped::TraceRecorder(eventsPerThread);
+	traceFile = filename;
+	phaseProfile->setTrace(traceRecorder);
+}
+
+bool Ped::Model::writeTrace(const char *filename) const
+{
+	if (traceRecorder == NULL)
+	{
+		return false;
+	}
+	if (traceRecorder->getDroppedEvents() > 0)
+	{
+		std::cout << "Note: the trace buffers were full, " << traceRecorder->getDroppedEvents() << " events were dropped." << std::endl;
+	}
+	return traceRecorder->write(filename);
+}
@@ -0,0 +1,64 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// TraceRecorder keeps a timeline of the coarse tick phases (see
+// ped_profile.h) of every thread: the tick, the backend, every OMP
+// region or CTHREADS chunk, the barrier waits and the stages after
+// the move. Each phase is stored as one complete event (begin and
+// duration) in the recording thread's own buffer, which is allocated
+// once, when the thread records its first event; a full buffer drops
+// further events instead of growing. A tick records about ten events
+// per thread. The buffers are those of the profile's thread slots, so
+// the new threads CTHREADS starts every tick continue the row of their
+// worker.
+//
+// write() dumps the timeline in the Chrome trace event format, which
+// chrome://tracing and Perfetto (ui.perfetto.dev) can open.
+//
+// Recording only happens in libpedsim builds with PED_PROFILE.
+//
+#ifndef _ped_trace_h_
+#define _ped_trace_h_
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+#include "ped_profile.h"
+
+namespace Ped {
+  class TraceRecorder
+  {
+  public:
+    TraceRecorder(size_t eventsPerThread = 1 << 18);
+    ~TraceRecorder();
+
+    // Called by the thread that ran the phase; begin is on the steady clock
+    void record(PHASE phase, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::duration duration, int64_t arg);
+
+    // Writes all recorded events as a Chrome trace (JSON)
+    bool write(const char *filename) const;
+
+    size_t getDroppedEvents() const;
+
+  private:
+    struct Event {
+      int64_t begin;
+      int64_t duration;
+      int64_t arg;
+      int32_t phase;
+    };
+
+    struct alignas(64) Buffer {
+      Event *events;
+      size_t count;
+      size_t dropped;
+    };
+
+    size_t capacity;
+    std::chrono::steady_clock::time_point origin;
+    Buffer buffers[PhaseProfile::MAX_THREADS];
+  };
+}
+
+#endif
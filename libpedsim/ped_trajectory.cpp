@@ -0,0 +1,293 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Background trajectory recording and playback, see ped_trajectory.h
+//
+#include "ped_trajectory.h"
+#include "ped_model.h"
+
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char TRAJECTORY_MAGIC[8] = "PEDTRJ1";
+
+// The file grows by at least this much at a time
+#define TRAJECTORY_GROWTH ((size_t) 64 << 20)
+
+static uint64_t align64(uint64_t offset)
+{
+	return (offset + 63) & ~(uint64_t) 63;
+}
+
+void Ped::TrajectoryRecorder::layout(uint64_t agentCount, uint64_t &yOffset, uint64_t &blockSize)
+{
+	yOffset = 64 + align64(agentCount * sizeof(int32_t));
+	blockSize = yOffset + align64(agentCount * sizeof(int32_t));
+}
+
+Ped::TrajectoryRecorder::TrajectoryRecorder(const char *filename, const std::vector<Tagent*> &agents, int extentX, int extentY,
+	int agentStride, int ringSize) :
+	recorded(agents, agentStride), head(0), tail(0), stopping(false), fd(-1), map(NULL), mapped(0), written(0), dropped(0)
+{
+	const size_t count = recorded.size();
+	layout(count, yOffset, blockSize);
+
+	fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || !reserve(64))
+	{
+		std::cerr << "Warning: could not open trajectory file " << filename << "." << std::endl;
+		if (fd >= 0) close(fd);
+		fd = -1;
+		return;
+	}
+
+	TrajectoryHeader *h = header();
+	memset(h, 0, sizeof(TrajectoryHeader));
+	memcpy(h->magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+	h->version = VERSION;
+	h->agentStride = recorded.getStride();
+	h->agentCount = count;
+	h->totalAgents = agents.size();
+	h->blockSize = blockSize;
+	h->yOffset = yOffset;
+	h->blockCount = 0;
+	h->extentX = extentX;
+	h->extentY = extentY;
+
+	// All buffers are allocated up front, recording never allocates
+	ring.resize(ringSize > 1 ? ringSize : 2);
+	for (auto& slot : ring)
+	{
+		slot.x.resize(count);
+		slot.y.resize(count);
+	}
+
+	sem_init(&filled, 0, 0);
+	writer = std::thread(&Ped::TrajectoryRecorder::writerLoop, this);
+}
+
+Ped::TrajectoryRecorder::~TrajectoryRecorder()
+{
+	if (fd < 0)
+	{
+		return;
+	}
+
+	stopping.store(true);
+	sem_post(&filled);
+	writer.join();
+	sem_destroy(&filled);
+
+	// Drop the unused tail of the last growth step
+	const size_t size = 64 + header()->blockCount * blockSize;
+	munmap(map, mapped);
+	if (ftruncate(fd, size) != 0)
+	{
+		std::cerr << "Warning: could not truncate trajectory file." << std::endl;
+	}
+	close(fd);
+
+	if (dropped > 0)
+	{
+		std::cout << "Note: trajectory recording dropped " << dropped.load() << " ticks." << std::endl;
+	}
+}
+
+bool Ped::TrajectoryRecorder::record(long tick)
+{
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	const size_t h = head.load(std::memory_order_relaxed);
+	if (h - tail.load(std::memory_order_acquire) >= ring.size())
+	{
+		dropped++;
+		return false;
+	}
+
+	Slot &slot = ring[h % ring.size()];
+	slot.tick = tick;
+	recorded.copy(slot.x.data(), slot.y.data());
+
+	// Publish the slot
+	head.store(h + 1, std::memory_order_release);
+	sem_post(&filled);
+	return true;
+}
+
+void Ped::TrajectoryRecorder::writerLoop()
+{
+	while (true)
+	{
+		sem_wait(&filled);
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+		{
+			// Woken up without a slot: only happens when stopping,
+			// after everything has been written
+			if (stopping.load())
+			{
+				return;
+			}
+			continue;
+		}
+
+		writeSlot(ring[t % ring.size()]);
+		tail.store(t + 1, std::memory_order_release);
+	}
+}
+
+void Ped::TrajectoryRecorder::writeSlot(const Slot &slot)
+{
+	TrajectoryHeader *h = header();
+	const size_t offset = 64 + h->blockCount * blockSize;
+	if (!reserve(offset + blockSize))
+	{
+		// Disk full or similar: count it like a tick that did not fit
+		dropped++;
+		return;
+	}
+	h = header();
+
+	char *block = map + offset;
+	int64_t tick = slot.tick;
+	memcpy(block, &tick, sizeof(tick));
+	memcpy(block + 64, slot.x.data(), slot.x.size() * sizeof(int32_t));
+	memcpy(block + yOffset, slot.y.data(), slot.y.size() * sizeof(int32_t));
+
+	h->blockCount++;
+	written++;
+}
+
+// Makes sure the first bytes of the file are mapped, growing the
+// file (and the mapping) geometrically
+bool Ped::TrajectoryRecorder::reserve(size_t bytes)
+{
+	if (bytes <= mapped)
+	{
+		return true;
+	}
+	size_t size = std::max(bytes, std::max(mapped * 2, TRAJECTORY_GROWTH));
+	if (ftruncate(fd, size) != 0)
+	{
+		return false;
+	}
+	void *data = map == NULL
+		? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+		: mremap(map, mapped, size, MREMAP_MAYMOVE);
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+	map = (char*) data;
+	mapped = size;
+	return true;
+}
+
+// Blocks the kernel is asked to read ahead of the playback position
+#define TRAJECTORY_READAHEAD 4
+
+Ped::TrajectoryReader::TrajectoryReader(const char *filename) :
+	map(NULL), mapped(0), block0(NULL), blockCount(0), blockSize(0), yOffset(0)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || (size_t) info.st_size < 64)
+	{
+		std::cerr << "Warning: could not open trajectory file " << filename << "." << std::endl;
+		if (fd >= 0) close(fd);
+		return;
+	}
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		std::cerr << "Warning: could not map trajectory file " << filename << "." << std::endl;
+		return;
+	}
+
+	const TrajectoryHeader *h = (const TrajectoryHeader*) data;
+	uint64_t expectedYOffset, expectedBlockSize;
+	TrajectoryRecorder::layout(h->agentCount, expectedYOffset, expectedBlockSize);
+	if (memcmp(h->magic, TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC)) != 0 || h->version != TrajectoryRecorder::VERSION
+		|| h->blockSize != expectedBlockSize || h->yOffset != expectedYOffset)
+	{
+		std::cerr << "Warning: ignoring invalid or outdated trajectory file " << filename << "." << std::endl;
+		munmap(data, info.st_size);
+		return;
+	}
+
+	map = (char*) data;
+	mapped = info.st_size;
+	block0 = map + 64;
+	blockSize = h->blockSize;
+	yOffset = h->yOffset;
+
+	// A recording that was interrupted may still be growing or be cut
+	// short: only use the blocks that are complete
+	blockCount = std::min<uint64_t>(h->blockCount, (mapped - 64) / blockSize);
+
+	// Playback mostly reads forward
+	madvise(map, mapped, MADV_SEQUENTIAL);
+}
+
+Ped::TrajectoryReader::~TrajectoryReader()
+{
+	if (map != NULL)
+	{
+		munmap(map, mapped);
+	}
+}
+
+size_t Ped::TrajectoryReader::findBlock(long tick) const
+{
+	// First block after tick
+	size_t lo = 0, hi = blockCount;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (getTick(mid) <= tick)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return lo > 0 ? lo - 1 : 0;
+}
+
+void Ped::TrajectoryReader::read(size_t block, int32_t *x, int32_t *y) const
+{
+	const size_t count = getAgentCount();
+	memcpy(x, getX(block), count * sizeof(int32_t));
+	memcpy(y, getY(block), count * sizeof(int32_t));
+
+	// Overlap reading the next frames with rendering this one
+	if (block + 1 < blockCount)
+	{
+		const size_t page = sysconf(_SC_PAGESIZE);
+		const size_t begin = (64 + (block + 1) * blockSize) & ~(page - 1);
+		const size_t end = std::min<size_t>(mapped, 64 + (block + 1 + TRAJECTORY_READAHEAD) * blockSize);
+		madvise(map + begin, end - begin, MADV_WILLNEED);
+	}
+}
+
+// Starts recording the agent positions every Nth tick
+void Ped::Model::enableTrajectoryRecording(const char *filename, int everyNthTick, int agentStride)
+{
+	delete trajectoryRecorder;
+	trajectoryRecorder = new Ped::TrajectoryRecorder(filename, agents, extentX, extentY, agentStride);
+	trajectoryEvery = everyNthTick > 0 ? everyNthTick : 1;
+
+	// The starting positions
+	trajectoryRecorder->record(tickCount);
+}
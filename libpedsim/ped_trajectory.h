@@ -0,0 +1,164 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// TrajectoryRecorder keeps the agent positions of every recorded
+// tick for post-processing. At the end of a tick the positions are
+// copied into a preallocated slot of a single-producer /
+// single-consumer ring (no locks on the tick loop's side); a
+// background thread moves full slots into a memory-mapped file that
+// grows as needed. When the writer falls behind and the ring is
+// full, ticks are dropped (and counted) instead of stalling the
+// simulation.
+//
+// Only every agentStride-th agent is recorded. Agents are recorded
+// in the order they had when the recorder was created (see
+// ped_positions.h), so a column entry always belongs to the same
+// agent, even when the model reorders its agents.
+//
+// The header also holds the extent of the world (see
+// Model::getExtentX), so that a player can size its view without
+// setting up the scenario.
+//
+// File layout (little endian):
+//   TrajectoryHeader, padded to 64 bytes
+//   blockCount blocks of blockSize bytes each:
+//     int64 tick            at 0
+//     int32 x[agentCount]   at 64
+//     int32 y[agentCount]   at yOffset
+// Blocks have a fixed size and increasing ticks, so a tick can be
+// found by binary search over the blocks.
+//
+// TrajectoryReader maps a recording for playback: seeking to a tick
+// is a binary search over the block ticks, and every block is a
+// complete frame, so no earlier block has to be read to show it.
+//
+#ifndef _ped_trajectory_h_
+#define _ped_trajectory_h_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <semaphore.h>
+
+#include "ped_positions.h"
+
+namespace Ped {
+  class Tagent;
+
+  struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t agentStride;
+    // Recorded agents per block, and agents in the model
+    uint64_t agentCount;
+    uint64_t totalAgents;
+    uint64_t blockSize;
+    uint64_t yOffset;
+    // Updated after every block, so that an interrupted recording
+    // is readable up to the last complete block
+    uint64_t blockCount;
+    uint32_t extentX;
+    uint32_t extentY;
+  };
+
+  class TrajectoryRecorder
+  {
+  public:
+    static const uint32_t VERSION = 2;
+
+    // Has to be created after Model::setup, see AgentPositions
+    TrajectoryRecorder(const char *filename, const std::vector<Tagent*> &agents, int extentX, int extentY,
+      int agentStride = 1, int ringSize = 8);
+
+    // Writes the remaining ticks and truncates the file to its final size
+    ~TrajectoryRecorder();
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Copies the positions of the recorded agents into the ring.
+    // Returns false if the tick had to be dropped.
+    bool record(long tick);
+
+    long getWrittenTicks() const { return written; }
+    long getDroppedTicks() const { return dropped; }
+
+    // Block geometry for agentCount recorded agents
+    static void layout(uint64_t agentCount, uint64_t &yOffset, uint64_t &blockSize);
+
+  private:
+    struct Slot {
+      long tick;
+      std::vector<int32_t> x;
+      std::vector<int32_t> y;
+    };
+
+    AgentPositions recorded;
+    std::vector<Slot> ring;
+
+    // head: next slot to fill (tick loop), tail: next slot to write (writer)
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    sem_t filled;
+    std::atomic<bool> stopping;
+
+    int fd;
+    char *map;
+    size_t mapped;
+    uint64_t blockSize;
+    uint64_t yOffset;
+    std::atomic<long> written;
+    std::atomic<long> dropped;
+    std::thread writer;
+
+    TrajectoryHeader * header() const { return (TrajectoryHeader*) map; }
+    bool reserve(size_t bytes);
+    void writerLoop();
+    void writeSlot(const Slot &slot);
+  };
+
+  class TrajectoryReader
+  {
+  public:
+    // Maps a recording read-only; isOpen() is false if it is not a
+    // valid trajectory file
+    TrajectoryReader(const char *filename);
+    ~TrajectoryReader();
+
+    bool isOpen() const { return map != NULL; }
+
+    size_t getBlockCount() const { return blockCount; }
+    size_t getAgentCount() const { return header()->agentCount; }
+    size_t getTotalAgents() const { return header()->totalAgents; }
+    int getAgentStride() const { return header()->agentStride; }
+    int getExtentX() const { return header()->extentX; }
+    int getExtentY() const { return header()->extentY; }
+
+    long getTick(size_t block) const { return *(const int64_t*) (block0 + block * blockSize); }
+
+    // The last block recorded at or before tick (the first block if
+    // tick precedes the recording)
+    size_t findBlock(long tick) const;
+
+    // The position columns of a block
+    const int32_t * getX(size_t block) const { return (const int32_t*) (block0 + block * blockSize + 64); }
+    const int32_t * getY(size_t block) const { return (const int32_t*) (block0 + block * blockSize + yOffset); }
+
+    // Copies the positions of a block and asks the kernel to read the
+    // following blocks ahead, so that playback does not wait for the disk
+    void read(size_t block, int32_t *x, int32_t *y) const;
+
+  private:
+    char *map;
+    size_t mapped;
+    const char *block0;
+    size_t blockCount;
+    uint64_t blockSize;
+    uint64_t yOffset;
+
+    const TrajectoryHeader * header() const { return (const TrajectoryHeader*) map; }
+  };
+}
+
+#endif
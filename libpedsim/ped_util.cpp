@@ -0,0 +1,68 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// See ped_util.h
+//
+#include "ped_util.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+#include <unistd.h>
+
+std::vector<std::string> Ped::splitList(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (!item.empty())
+		{
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+std::string Ped::hostName()
+{
+	char host[256] = "unknown";
+	gethostname(host, sizeof(host) - 1);
+	return host;
+}
+
+std::map<std::string, std::string> Ped::readCacheFile(const std::string &filename)
+{
+	std::map<std::string, std::string> cache;
+	std::ifstream file(filename);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t tab = line.find('\t');
+		if (tab != std::string::npos)
+		{
+			cache[line.substr(0, tab)] = line.substr(tab + 1);
+		}
+	}
+	return cache;
+}
+
+bool Ped::writeCacheFile(const std::string &filename, const std::map<std::string, std::string> &cache)
+{
+	const std::string tmp = filename + ".tmp";
+	{
+		std::ofstream file(tmp);
+		for (const auto &entry : cache)
+		{
+			file << entry.first << "\t" << entry.second << "\n";
+		}
+		if (!file)
+		{
+			remove(tmp.c_str());
+			return false;
+		}
+	}
+	return rename(tmp.c_str(), filename.c_str()) == 0;
+}
@@ -0,0 +1,46 @@
+//
+// Adapted for Low Level Parallel Programming 2017
+//
+// Small helpers shared by libpedsim and its tools: the splitmix64
+// mixer, comma-separated lists and the per-machine cache files of the
+// benchmark and AUTO.
+//
+#ifndef _ped_util_h_
+#define _ped_util_h_ 1
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Ped {
+	// The splitmix64 finalizer
+	inline uint64_t mix64(uint64_t z) {
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	// splitmix64: tiny, fast and the same everywhere (unlike the
+	// distributions of the standard library)
+	inline uint64_t splitmix64(uint64_t &state) {
+		return mix64(state += 0x9E3779B97F4A7C15ull);
+	}
+
+	// Splits "a,b,c", skipping empty items
+	std::vector<std::string> splitList(const std::string &list);
+
+	// The name of this machine, for the keys of cache files
+	std::string hostName();
+
+	// A cache file: one "key<TAB>value" line per entry (neither may
+	// contain a tab). A missing file is an empty cache.
+	std::map<std::string, std::string> readCacheFile(const std::string &filename);
+
+	// Writes to a temporary file and renames it over the cache, so a
+	// concurrent reader never sees half a file. Returns false if it
+	// could not be written.
+	bool writeCacheFile(const std::string &filename, const std::map<std::string, std::string> &cache);
+}
+
+#endif
@@ -0,0 +1,427 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// pedsim-microbench: times the hot kernels of libpedsim one at a time.
+//
+// Every kernel runs on a synthetic scenario of the requested size and
+// density: the agents are spread over a square (agents / density
+// cells) and walk between its four corners. A kernel is run once to
+// warm up and then a number of times; the median and the fastest run
+// are reported in nanoseconds per item (an agent or a pixel).
+//
+// The bytes per item are the data the kernel has to read and write
+// at least once, not measured memory traffic, so the bandwidth column
+// is a lower bound on what the kernel moves.
+//
+// The kernels that search all agents for every agent (the neighbor
+// search and both moves) only run for a sample of the agents.
+//
+// Build libpedsim without PROFILE=1: the phase timers would be timed
+// along with the kernels.
+//
+
+#include "ped_model.h"
+#include "ped_agent.h"
+#include "ped_waypoint.h"
+#include "ped_util.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <omp.h>
+
+#include <stdint.h>
+
+using namespace std;
+
+struct Options {
+	size_t agents = 10000;
+	double density = 0.3;
+	int repeat = 10;
+	size_t queries = 1000;
+	int cellSize = 5;
+	uint64_t seed = 1;
+};
+
+struct Result {
+	string kernel;
+	string unit;
+	// Items per run
+	double items;
+	double median, min;
+	double bytesPerItem;
+};
+
+// A square of agents / density cells with the agents on distinct,
+// randomly chosen cells. Every agent walks between two of the four
+// corners.
+static void makeScenario(const Options &options, vector<Ped::Tagent*> &agents, vector<Ped::Twaypoint*> &waypoints)
+{
+	const uint32_t side = (uint32_t) std::ceil(std::sqrt(options.agents / options.density));
+	const double margin = side / 8.0;
+	const double radius = std::max(2.0, side / 16.0);
+	waypoints.push_back(new Ped::Twaypoint(margin, margin, radius));
+	waypoints.push_back(new Ped::Twaypoint(side - margin, margin, radius));
+	waypoints.push_back(new Ped::Twaypoint(side - margin, side - margin, radius));
+	waypoints.push_back(new Ped::Twaypoint(margin, side - margin, radius));
+
+	// Partial Fisher-Yates over the cells
+	uint64_t state = options.seed;
+	vector<uint32_t> cells((size_t) side * side);
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		cells[i] = (uint32_t) i;
+	}
+	for (size_t i = 0; i < options.agents; i++)
+	{
+		size_t j = i + Ped::splitmix64(state) % (cells.size() - i);
+		std::swap(cells[i], cells[j]);
+
+		Ped::Tagent *agent = new Ped::Tagent((int) (cells[i] % side), (int) (cells[i] / side));
+		int first = Ped::splitmix64(state) % 4;
+		agent->addWaypoint(waypoints[first]);
+		agent->addWaypoint(waypoints[(first + 2) % 4]);
+		agents.push_back(agent);
+	}
+}
+
+// Runs kernel warmup + repeat times; prepare (not timed) runs before
+// every run
+static void timeKernel(const Options &options, Result &result, const function<void()> &kernel, const function<void()> &prepare = function<void()>())
+{
+	vector<double> runs;
+	for (int run = -1; run < options.repeat; run++)
+	{
+		if (prepare)
+		{
+			prepare();
+		}
+		auto start = chrono::steady_clock::now();
+		kernel();
+		auto stop = chrono::steady_clock::now();
+		if (run >= 0)
+		{
+			runs.push_back(chrono::duration_cast<chrono::nanoseconds>(stop - start).count() / result.items);
+		}
+	}
+	std::sort(runs.begin(), runs.end());
+	result.median = runs[runs.size() / 2];
+	result.min = runs[0];
+}
+
+// Keeps the results of the searches alive
+static volatile size_t sink;
+
+namespace Ped {
+
+// Has access to the private kernels of the model
+class KernelBench
+{
+public:
+	KernelBench(const Options &options_) : options(options_) {}
+
+	void neighbors(vector<Result> &results)
+	{
+		Ped::Model model;
+		setup(model, Ped::SEQ);
+		const vector<Ped::Tagent*> &agents = model.agents;
+		const size_t queries = std::min(options.queries, agents.size());
+
+		// A pointer, the two coordinate pointers and the coordinates of every agent
+		Result result = { "getNeighbors", "agent", (double) queries * agents.size(), 0, 0, 8 + 16 + 8 };
+		timeKernel(options, result, [&]() {
+			size_t found = 0;
+			for (size_t i = 0; i < queries; i++)
+			{
+				found += model.getNeighbors(agents[i]->getX(), agents[i]->getY(), 2).size();
+			}
+			sink = found;
+		});
+		results.push_back(result);
+	}
+
+	void move(vector<Result> &results)
+	{
+		Ped::Model model;
+		setup(model, Ped::SEQ);
+		const vector<Ped::Tagent*> &agents = model.agents;
+		const size_t queries = std::min(options.queries, agents.size());
+
+		// Dominated by the neighbor search over all agents
+		Result result = { "move", "agent", (double) queries, 0, 0, 32.0 * agents.size() };
+		timeKernel(options, result, [&]() {
+			for (size_t i = 0; i < queries; i++)
+			{
+				model.move(agents[i]);
+			}
+		}, [&]() {
+			computeDesired(agents, queries);
+		});
+		results.push_back(result);
+	}
+
+	void moveAtomic(vector<Result> &results)
+	{
+		Ped::Model model;
+		setup(model, Ped::OMP);
+		const size_t queries = std::min(options.queries, model.agents.size());
+
+		Result result = { "move_atomic", "agent", (double) queries, 0, 0, 32.0 * model.agents.size() };
+		timeKernel(options, result, [&]() {
+			for (size_t i = 0; i < queries; i++)
+			{
+				model.move_atomic(model.agents[i]);
+			}
+		}, [&]() {
+			// Fresh regions and boundary claims, as in every tick
+			model.repopulate_dynamic_regions();
+			computeDesired(model.agents, queries);
+		});
+		results.push_back(result);
+	}
+
+	void desired(vector<Result> &results)
+	{
+		Ped::Model model;
+		setup(model, Ped::SEQ);
+		const vector<Ped::Tagent*> &agents = model.agents;
+
+		// The agent and the coordinates of its destination
+		Result result = { "computeNextDesiredPosition", "agent", (double) agents.size(), 0, 0, 8 + sizeof(Ped::Tagent) + 8 + 24 };
+		timeKernel(options, result, [&]() {
+			computeDesired(agents, agents.size());
+		});
+		results.push_back(result);
+	}
+
+	void simd(vector<Result> &results)
+	{
+		Ped::Model model;
+		setup(model, Ped::SIMD);
+
+		// Reads the positions and destinations, writes the positions
+		Result result = { "simd_tick", "agent", (double) model.agents.size(), 0, 0, 5 * 4 + 2 * 4 };
+		timeKernel(options, result, [&]() {
+			model.tick();
+		});
+		results.push_back(result);
+	}
+
+	void regions(vector<Result> &results)
+	{
+		Ped::Model model;
+		setup(model, Ped::OMP);
+
+		// Every agent pointer is read, its x coordinate and the pointer
+		// written to its region
+		Result result = { "populate_dynamic_regions", "agent", (double) model.agents.size(), 0, 0, 8 + 4 + 8 };
+		timeKernel(options, result, [&]() {
+			model.repopulate_dynamic_regions();
+		});
+		results.push_back(result);
+	}
+
+	void heatmap(vector<Result> &results, bool decay, bool scatter, bool scale, bool blur)
+	{
+		Ped::Model model;
+		setup(model, Ped::SEQ);
+		model.enableHeatmap(0, options.cellSize);
+		computeDesired(model.agents, model.agents.size());
+
+		const double pixels = (double) model.heatmapSize * model.heatmapSize;
+		const double scaledPixels = pixels * options.cellSize * options.cellSize;
+		if (decay)
+		{
+			Result result = { "heatmap_decay", "pixel", pixels, 0, 0, 4 + 4 };
+			timeKernel(options, result, [&]() {
+				model.decayHeatmapSeq();
+			});
+			results.push_back(result);
+		}
+		if (scatter)
+		{
+			// The agent, its position and desired position and the heat
+			Result result = { "heatmap_scatter", "agent", (double) model.agents.size(), 0, 0, 8 + 16 + 16 + 8 };
+			timeKernel(options, result, [&]() {
+				model.accumulateAgentFields();
+			}, [&]() {
+				// Keeps the heat from overflowing
+				memset(model.heatmap[0], 0, model.heatmapSize * model.heatmapSize * sizeof(int));
+			});
+			results.push_back(result);
+		}
+		if (scale)
+		{
+			// Writes every scaled pixel once, reads every heatmap cell once
+			const double cells = options.cellSize * options.cellSize;
+			Result result = { "heatmap_scale", "pixel", scaledPixels, 0, 0, 4 + 4 / cells };
+			timeKernel(options, result, [&]() {
+				model.scaleHeatmapSeq();
+			});
+			results.push_back(result);
+		}
+		if (blur)
+		{
+			Result result = { "heatmap_blur", "pixel", scaledPixels, 0, 0, 4 + 4 };
+			timeKernel(options, result, [&]() {
+				model.blurHeatmapSeq();
+			});
+			results.push_back(result);
+		}
+	}
+
+private:
+	const Options &options;
+
+	void setup(Ped::Model &model, Ped::IMPLEMENTATION implementation)
+	{
+		vector<Ped::Tagent*> agents;
+		vector<Ped::Twaypoint*> waypoints;
+		makeScenario(options, agents, waypoints);
+		model.setup(agents, waypoints, implementation);
+	}
+
+	static void computeDesired(const vector<Ped::Tagent*> &agents, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			agents[i]->computeNextDesiredPosition();
+		}
+	}
+};
+
+}
+
+static const char * const KERNELS[] = { "neighbors", "move", "move_atomic", "desired", "simd", "regions", "decay", "scatter", "scale", "blur" };
+
+int main(int argc, char*argv[])
+{
+	Options options;
+	vector<string> kernels(std::begin(KERNELS), std::end(KERNELS));
+	string format = "text";
+	int threads = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--help") == 0)
+		{
+			cout << "Usage: " << argv[0] << " [--agents N] [--density D] [--repeat N] [--queries N] [--cell-size N]"
+				<< " [--seed N] [--threads N] [--format text|csv] [kernel,...]" << endl;
+			cout << "Kernels: neighbors, move, move_atomic, desired, simd, regions, decay, scatter, scale, blur" << endl;
+			return 0;
+		}
+		else if (strcmp(argv[i], "--agents") == 0 && hasValue)
+		{
+			options.agents = (size_t) std::stod(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--density") == 0 && hasValue)
+		{
+			options.density = std::stod(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--repeat") == 0 && hasValue)
+		{
+			options.repeat = std::stoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--queries") == 0 && hasValue)
+		{
+			options.queries = (size_t) std::stod(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--cell-size") == 0 && hasValue)
+		{
+			options.cellSize = std::stoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+		{
+			options.seed = std::stoull(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+		{
+			threads = std::stoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--format") == 0 && hasValue)
+		{
+			format = argv[++i];
+		}
+		else if (argv[i][0] != '-')
+		{
+			kernels = Ped::splitList(argv[i]);
+		}
+		else
+		{
+			cerr << "Unrecognized option: \"" << argv[i] << "\"." << endl;
+			return 1;
+		}
+	}
+
+	if (options.agents < 4 || options.density <= 0 || options.density > 1 || options.repeat < 1 || options.queries < 1 || options.cellSize < 1)
+	{
+		cerr << "Need at least 4 agents, a density in (0, 1] and positive repeat, queries and cell size." << endl;
+		return 1;
+	}
+	for (const string &kernel : kernels)
+	{
+		if (std::find(std::begin(KERNELS), std::end(KERNELS), kernel) == std::end(KERNELS))
+		{
+			cerr << "Unrecognized kernel: \"" << kernel << "\"." << endl;
+			return 1;
+		}
+	}
+	if (format != "text" && format != "csv")
+	{
+		cerr << "Unrecognized format: \"" << format << "\"." << endl;
+		return 1;
+	}
+	if (threads > 0)
+	{
+		omp_set_num_threads(threads);
+	}
+
+	auto wants = [&](const char *kernel) { return std::find(kernels.begin(), kernels.end(), kernel) != kernels.end(); };
+
+	Ped::KernelBench bench(options);
+	vector<Result> results;
+	if (wants("neighbors")) bench.neighbors(results);
+	if (wants("move")) bench.move(results);
+	if (wants("move_atomic")) bench.moveAtomic(results);
+	if (wants("desired")) bench.desired(results);
+	if (wants("simd")) bench.simd(results);
+	if (wants("regions")) bench.regions(results);
+	if (wants("decay") || wants("scatter") || wants("scale") || wants("blur"))
+	{
+		bench.heatmap(results, wants("decay"), wants("scatter"), wants("scale"), wants("blur"));
+	}
+
+	if (format == "csv")
+	{
+		cout << "kernel,unit,items,ns_per_item,min_ns_per_item,bytes_per_item,gb_per_s" << endl;
+	}
+	else
+	{
+		printf("%zu agents, density %g, %d runs\n", options.agents, options.density, options.repeat);
+		printf("%-28s %-6s %12s %12s %12s %12s %10s\n", "kernel", "unit", "items", "ns/item", "min ns/item", "bytes/item", "GB/s");
+	}
+	for (const Result &result : results)
+	{
+		// Bytes per nanosecond are GB/s
+		double bandwidth = result.bytesPerItem / result.median;
+		if (format == "csv")
+		{
+			printf("%s,%s,%.0f,%.3f,%.3f,%.1f,%.3f\n", result.kernel.c_str(), result.unit.c_str(), result.items,
+				result.median, result.min, result.bytesPerItem, bandwidth);
+		}
+		else
+		{
+			printf("%-28s %-6s %12.0f %12.3f %12.3f %12.1f %10.3f\n", result.kernel.c_str(), result.unit.c_str(), result.items,
+				result.median, result.min, result.bytesPerItem, bandwidth);
+		}
+	}
+
+	return 0;
+}